@@ -9,47 +9,87 @@
 #endif
 
 #include "src/FileCoder.hpp"
+#include "src/RecoveryVolume.hpp"
+#include "src/JobQueue.hpp"
+#include "src/Tuner.hpp"
 using namespace ErrorCorrectingCodes;
 
-#include <mutex>
-std::mutex m;
+#include <iostream>
 
-volatile uint64_t process_length;
+//the callbacks come from one reporter thread, one at a time
+uint64_t process_length;
+bool batch_mode = false;
 
-
-uint32_t __stdcall encode_callback(uint64_t offset,uint32_t length,uint64_t total_length,uint32_t result)
+void print_progress(uint64_t total_length)
 {
-	uint32_t ret = 0;
-	m.lock();
-	process_length += length;
+	if (batch_mode || total_length == FileIO::UNKNOWN_LENGTH) {
+		//a pipe or many files, only the amount done so far is known
+		int n = printf("%lluMB", (unsigned long long)(process_length >> 20));
+		fflush(stdout);
+		for (int i = 0; i < n; i++) printf("\b");
+		return;
+	}
 	uint32_t percent = (uint32_t)(process_length * 100 / total_length);
 	if (percent > 100) percent = 100;
 	printf("%3d%%", percent);
 	fflush(stdout);
 	printf("\b\b\b\b");
-	m.unlock();
-	return ret;
+}
+
+uint32_t __stdcall encode_callback(uint64_t offset,uint32_t length,uint64_t total_length,uint32_t result)
+{
+	process_length += length;
+	print_progress(total_length);
+	return 0;
 }
 
 uint32_t __stdcall decode_callback(uint64_t offset,uint32_t length,uint64_t total_length,uint32_t result)
 {
 	uint32_t ret = 0;
-	m.lock();
 	process_length += length; 
-	uint32_t percent = (uint32_t)(process_length * 100 / total_length);
-	if (percent > 100) percent = 100;
-	printf("%3d%%", percent);
-	fflush(stdout);
-	printf("\b\b\b\b");
+	print_progress(total_length);
 
 	if (result == IReedSolomonCoder::ECC_FAILED) {
 		printf("fix failed\n");
 		ret = CEccFileCoder::CODER_BREAK;
 	}
-	m.unlock();
 	return ret;
 }
 
+void __stdcall tuner_callback(const char* setting, uint32_t value, double mb_per_second)
+{
+	printf("%s=%u: %.1fMB/s\n", setting, value, mb_per_second);
+}
+
+//one file name per line, from stdin for "-"
+bool read_file_list(const std::string& list_file, std::vector<std::string>& files)
+{
+	std::ifstream list_stream;
+	if (list_file != FileIO::PIPE_FILE) {
+		list_stream.open(list_file);
+		if (!list_stream.is_open()) {
+			return false;
+		}
+	}
+	std::istream& in = list_file != FileIO::PIPE_FILE ? list_stream : std::cin;
+	std::string line;
+	while (std::getline(in, line)) {
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (!line.empty()) files.push_back(line);
+	}
+	return true;
+}
+
+//0 for a pipe, its code is not fitted to its length
+uint64_t get_file_length(const std::string& file)
+{
+	if (file == FileIO::PIPE_FILE) {
+		return 0;
+	}
+	std::unique_ptr<FileIO::IFileReader> reader(FileIO::OpenReader(file));
+	return reader ? reader->GetLength() : 0;
+}
+
 int main(int argc, char *argv[])
 {
 	/*printf("%d\n", argc);
@@ -71,45 +111,271 @@ int main(int argc, char *argv[])
 	argv[4] = "zzz";*/
 	//ecc.exe - d xxx2 yyy zzz
 
-	if (argc==5 && strcmp(argv[1], "-e") == 0) {
+	std::vector<std::string> args;
+	uint32_t io_backend = FileIO::IO_BACKEND_STREAM;
+	uint32_t io_depth = 0;
+	uint64_t mem_budget_mb = 0;
+	bool numa = false;
+	uint32_t codeword_bits = 16;
+	uint32_t codeword_field = 0;
+	uint32_t block_size = 0;
+	uint32_t shard_index = 0;
+	uint32_t shard_count = 0;
+	std::vector<CEccFileCoder::BYTE_RANGE> ranges;
+	for (int i = 1; i<argc; i++) {
+		if (strcmp(argv[i], "--mmap") == 0) {
+			io_backend = FileIO::IO_BACKEND_MMAP;
+			continue;
+		}
+		if (strcmp(argv[i], "--uring") == 0) {
+			io_backend = FileIO::IO_BACKEND_URING;
+			continue;
+		}
+		if (strncmp(argv[i], "--io-depth=", 11) == 0) {
+			io_depth = atoi(argv[i] + 11);
+			continue;
+		}
+		if (strncmp(argv[i], "--mem-budget=", 13) == 0) {
+			mem_budget_mb = atoi(argv[i] + 13);
+			continue;
+		}
+		if (strncmp(argv[i], "--bits=", 7) == 0) {
+			codeword_bits = atoi(argv[i] + 7);
+			continue;
+		}
+		if (strcmp(argv[i], "--gf2") == 0) {
+			codeword_field = CEccFileCoder::CODEWORD_BINARY_FIELD;
+			continue;
+		}
+		if (strncmp(argv[i], "--block=", 8) == 0) {
+			block_size = atoi(argv[i] + 8);
+			continue;
+		}
+		if (strncmp(argv[i], "--shard=", 8) == 0) {
+			if (sscanf(argv[i] + 8, "%u/%u", &shard_index, &shard_count) != 2 || shard_index >= shard_count) {
+				printf("incorrect input...\n");
+				return 1;
+			}
+			continue;
+		}
+		if (strcmp(argv[i], "--huge-pages") == 0) {
+			MemPool::SetHugePages(true);
+			continue;
+		}
+		if (strcmp(argv[i], "--numa") == 0) {
+			numa = true;
+			continue;
+		}
+		if (strncmp(argv[i], "--range=", 8) == 0) {
+			char* p = nullptr;
+			uint64_t offset = strtoull(argv[i] + 8, &p, 0);
+			uint64_t length = (*p == ',') ? strtoull(p + 1, nullptr, 0) : 0;
+			ranges.push_back(std::make_pair(offset, length));
+			continue;
+		}
+		args.push_back(argv[i]);
+	}
+
+	if (args.size()==4 && args[0] == "-e") {
 
-		std::string raw_file = argv[2];
-		std::string ecc_file = argv[3];
-		uint32_t percent = atoi(argv[4]);
+		std::string raw_file = args[1];
+		std::string ecc_file = args[2];
+		uint32_t percent = atoi(args[3].c_str());
 
 		CEccFileCoder fc;
+		fc.SetIoBackend(io_backend, io_depth);
+		fc.SetMemoryBudget(mem_budget_mb << 20);
+		fc.SetNumaAware(numa);
+		//the shards may run on hosts of other profiles, their params have to agree
+		uint32_t intertwine_mb = shard_count != 0 ? (uint32_t)Tuning::DEFAULT_INTERTWINE_MB : 0;
 		CEccFileCoder::ECC_PARAM param;
-		if (!fc.CreateEccParam(param, percent)) {
+		if (!fc.CreateEccParam(param, percent, codeword_bits | codeword_field, intertwine_mb, get_file_length(raw_file))) {
 			printf("incorrect input...\n");
 			return 1;
 		}
 
+		//progress would end up in the ecc data when it goes to stdout
+		CEccFileCoder::ECC_CALLBACK_FUNC func = &encode_callback;
+		if (ecc_file == FileIO::PIPE_FILE) {
+			func = nullptr;
+		}
+
+		process_length = 0;
+		bool ok = shard_count != 0 ?
+			fc.CreateEccShard(raw_file, ecc_file, param, shard_index, shard_count, func) :
+			fc.CreateEccFile(raw_file, ecc_file, param, func);
+		if (!ok) {
+			printf("runtime error...\n");
+			return 1;
+		}
+		return 0;
+	}
+
+	if (args.size()==4 && args[0] == "-d") {
+		std::string raw_file = args[1];
+		std::string ecc_file = args[2];
+		std::string fix_file = args[3];
+
+		CEccFileCoder fc;
+		fc.SetIoBackend(io_backend, io_depth);
+		fc.SetMemoryBudget(mem_budget_mb << 20);
+		fc.SetNumaAware(numa);
+
+		process_length = 0;
+		bool ok = ranges.empty() ?
+			fc.CheckEccFile(raw_file, ecc_file, fix_file, &decode_callback) :
+			fc.CheckEccFileRanges(raw_file, ecc_file, fix_file, ranges, &decode_callback);
+		if (!ok) {
+			printf("runtime error...\n");
+			return 1;
+		}
+		return 0;
+	}
+
+	if (args.size()==3 && args[0] == "-a") {
+		std::string raw_file = args[1];
+		std::string ecc_file = args[2];
+
+		CEccFileCoder fc;
+		fc.SetIoBackend(io_backend, io_depth);
+		fc.SetMemoryBudget(mem_budget_mb << 20);
+		fc.SetNumaAware(numa);
+
+		process_length = 0;
+		if (!fc.AppendEccFile(raw_file, ecc_file, &encode_callback)) {
+			printf("runtime error...\n");
+			return 1;
+		}
+		return 0;
+	}
+
+	if (args.size()>=3 && args[0] == "-m") {
+		std::string ecc_file = args[1];
+		std::vector<std::string> shard_files(args.begin() + 2, args.end());
+
+		CEccFileCoder fc;
+		fc.SetIoBackend(io_backend, io_depth);
+		if (!fc.MergeEccShards(shard_files, ecc_file)) {
+			printf("runtime error...\n");
+			return 1;
+		}
+		return 0;
+	}
+
+	if (args.size()==4 && args[0] == "-r") {
+		std::string raw_file = args[1];
+		std::string vol_file = args[2];
+		uint32_t percent = atoi(args[3].c_str());
+
+		CRecoveryVolumeCoder vc;
+		vc.SetIoBackend(io_backend, io_depth);
+		vc.SetMemoryBudget(mem_budget_mb << 20);
+
 		process_length = 0;
-		if (!fc.CreateEccFile(raw_file, ecc_file, param, &encode_callback)) {
+		if (!vc.CreateVolume(raw_file, vol_file, percent, block_size, &encode_callback)) {
 			printf("runtime error...\n");
 			return 1;
 		}
 		return 0;
 	}
 
-	if (argc==5 && strcmp(argv[1], "-d") == 0) {
-		std::string raw_file = argv[2];
-		std::string ecc_file = argv[3];
-		std::string fix_file = argv[4];
+	if (args.size()==4 && args[0] == "-R") {
+		std::string raw_file = args[1];
+		std::string vol_file = args[2];
+		std::string fix_file = args[3];
+
+		CRecoveryVolumeCoder vc;
+		vc.SetIoBackend(io_backend, io_depth);
+		vc.SetMemoryBudget(mem_budget_mb << 20);
+
+		process_length = 0;
+		if (!vc.RepairFile(raw_file, vol_file, fix_file, &decode_callback)) {
+			printf("runtime error...\n");
+			return 1;
+		}
+		return 0;
+	}
+
+	if ((args.size()==3 && args[0] == "-E") || (args.size()==2 && args[0] == "-D")) {
+		std::vector<std::string> raw_files, ecc_files, fix_files;
+		if (!read_file_list(args[1], raw_files)) {
+			printf("incorrect input...\n");
+			return 1;
+		}
+		for (size_t i = 0; i < raw_files.size(); i++) {
+			ecc_files.push_back(raw_files[i] + ".ecc");
+			fix_files.push_back(raw_files[i] + ".fix");
+		}
 
 		CEccFileCoder fc;
+		fc.SetIoBackend(io_backend, io_depth);
+		fc.SetMemoryBudget(mem_budget_mb << 20);
+		fc.SetNumaAware(numa);
 
+		batch_mode = true;
 		process_length = 0;
-		if (!fc.CheckEccFile(raw_file, ecc_file, fix_file, &decode_callback)) {
+		if (args[0] == "-E") {
+			//each file gets the code -e would give it
+			std::vector<CEccFileCoder::ECC_PARAM> params(raw_files.size());
+			for (size_t i = 0; i < raw_files.size(); i++) {
+				if (!fc.CreateEccParam(params[i], atoi(args[2].c_str()), codeword_bits | codeword_field, 0, get_file_length(raw_files[i]))) {
+					printf("incorrect input...\n");
+					return 1;
+				}
+			}
+			if (!fc.CreateEccFiles(raw_files, ecc_files, params, &encode_callback)) {
+				printf("runtime error...\n");
+				return 1;
+			}
+		}
+		else {
+			if (!fc.CheckEccFiles(raw_files, ecc_files, fix_files, &decode_callback)) {
+				printf("runtime error...\n");
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	if ((args.size()==1 || args.size()==2) && args[0] == "-t") {
+		CEccTuner tuner(CEccTuner::DEFAULT_SAMPLE_MB, CEccTuner::DEFAULT_IO_SAMPLE_MB, &tuner_callback);
+		Tuning::PROFILE profile;
+		if (!tuner.TuneAndSave(profile, args.size()==2 ? args[1] : "")) {
 			printf("runtime error...\n");
 			return 1;
 		}
+		printf("profile written to %s\n", Tuning::GetProfilePath().c_str());
 		return 0;
 	}
 
-	if (argc==2 && strcmp(argv[1], "-h") == 0) {
+	if (args.size()==1 && args[0] == "-h") {
 		printf("encode example: -e raw_file ecc_file percent\n");
 		printf("decode example: -d raw_file ecc_file fix_file\n");
+		printf("append example: -a raw_file ecc_file (raw_file grew since ecc_file was made)\n");
+		printf("merge example: -m ecc_file shard_file_0 ... shard_file_n-1 (made by -e with --shard=i/n,\n");
+		printf("               a shared ecc_file is given n times and merged in place)\n");
+		printf("recovery volume example: -r raw_file vol_file percent\n");
+		printf("repair from volume example: -R raw_file vol_file fix_file (fix_file may be raw_file itself)\n");
+		printf("batch encode example: -E list_file percent\n");
+		printf("batch decode example: -D list_file\n");
+		printf("tune example: -t [dir] (measure this machine for the defaults of the other commands, dir for the io test)\n");
+		printf("use \"-\" as raw_file to encode stdin, or as ecc_file to write the ecc to stdout\n");
+		printf("list_file names one raw_file per line (\"-\" for stdin), with ecc_file raw_file.ecc and fix_file raw_file.fix\n");
+		printf("options:\n");
+		printf("  --mmap          read raw and ecc files through a memory mapping\n");
+		printf("  --uring         use io_uring with O_DIRECT, bypassing the page cache\n");
+		printf("  --io-depth=N    requests kept in flight by --uring (default tuned, else %d)\n", FileIO::DEFAULT_IO_DEPTH);
+		printf("  --mem-budget=MB cap the stripe buffers, large stripes are coded in parts\n");
+		printf("  --bits=N        encode with 8 or 16 bits codewords (default 16)\n");
+		printf("  --gf2           encode over GF(2^8)/GF(2^16) instead of GF(257)/GF(65537),\n");
+		printf("                  fast for small parity, slow for large parity with --bits=16\n");
+		printf("  --block=BYTES   block size of -r, a multiple of %d (default about %d blocks)\n", CRecoveryVolumeCoder::BLOCK_ALIGN, CRecoveryVolumeCoder::DEFAULT_BLOCK_COUNT);
+		printf("  --shard=I/N     -e encodes only part I of N of raw_file, into ecc_file at its offsets,\n");
+		printf("                  ecc_file may be shared by the parts, -m checks them and makes the final ecc_file\n");
+		printf("  --huge-pages    back the stripe buffers with 2MB pages, faster but with more memory resident\n");
+		printf("  --numa          pin the threads and keep their stripe data on their numa node\n");
+		printf("  --range=OFF,LEN decode only the part of raw_file holding these bytes and write it\n");
+		printf("                  at its offset into fix_file (may be raw_file itself), can be repeated\n");
 		return 0;
 	}
 	
@@ -0,0 +1,451 @@
+#pragma once
+
+#ifndef _BINARYREEDSOLOMONCODER_HPP_
+#define _BINARYREEDSOLOMONCODER_HPP_
+
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+#include "Bit.hpp"
+#include "MemPool.hpp"
+#include "ReedSolomonCoder.hpp"
+
+//the pshufb kernels are built with -mssse3 (or /arch:AVX), else on gcc and clang for x86 they are built
+//for ssse3 alone and taken when the cpu has it
+#if defined(__SSSE3__) || defined(__AVX__)
+#	define GF_BINARY_HAS_SSSE3 1
+#	define GF_BINARY_SSSE3_TARGET
+#	define GF_BINARY_CPU_HAS_SSSE3() true
+#	include <tmmintrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define GF_BINARY_HAS_SSSE3 1
+#	define GF_BINARY_SSSE3_TARGET __attribute__((target("ssse3")))
+#	define GF_BINARY_CPU_HAS_SSSE3() (__builtin_cpu_supports("ssse3") != 0)
+#	include <tmmintrin.h>
+#else
+#	define GF_BINARY_HAS_SSSE3 0
+#endif
+
+namespace ErrorCorrectingCodes
+{
+
+	template<typename _ValType>
+	class CGFBinary//GF(2^8) or GF(2^16), addition is xor
+	{
+	public:
+		typedef _ValType ValType;
+		enum :uint32_t {
+			M = Bit::BITS_PER_INT8*sizeof(ValType),
+			Q = 1u << M,
+			PhiQ = Q - 1,
+			POLY = (M == 8) ? 0x11D : 0x1100B,	//primitive, x is a generator
+		};
+		static_assert(M == 8 || M == 16, "codeword does not match 8bit or 16bit!");
+
+	protected:
+		ValType m_pFMap[PhiQ * 2];
+		uint32_t m_pIMap[Q];
+	public:
+		BIT_INLINE static uint32_t Log(ValType x) {
+			assert(x != 0);
+			static const uint32_t* pIMap = GetInstance()->m_pIMap;
+			return pIMap[x];
+		}
+
+		BIT_INLINE static ValType Exp(uint32_t Power) {
+			static const ValType* pFMap = GetInstance()->m_pFMap;
+			return pFMap[Power];
+		}
+
+		BIT_INLINE static ValType Mul(ValType a, ValType b) {
+			return (a == 0 || b == 0) ? 0 : Exp(Log(a) + Log(b));
+		}
+
+		BIT_INLINE static ValType Div(ValType a, ValType b) {
+			assert(b != 0);
+			return (a == 0) ? 0 : Exp(Log(a) + PhiQ - Log(b));
+		}
+
+		// dst[i]^=c*src[i] for i<count
+		static void MulAdd(ValType* dst, const ValType* src, ValType c, uint32_t count) {
+			if (c == 0) {
+				return;
+			}
+			uint32_t i = MulAddKernel(dst, src, c, count);
+			uint32_t uiLogC = Log(c);
+			for (; i<count; i++) {
+				if (src[i] != 0) {
+					dst[i] ^= Exp(uiLogC + Log(src[i]));
+				}
+			}
+		}
+	protected:
+		enum :uint32_t {
+			MIN_KERNEL_COUNT = 64,	//below that the tables cost more than they save
+		};
+
+		// the multiplication by c is linear over GF(2): c*x is the xor of c*(every nibble of x),
+		// each of those is a 16 entry table, a pshufb looks up 16 of them at once
+		// return the number of words done, the caller does the rest
+#if GF_BINARY_HAS_SSSE3
+		static uint32_t MulAddKernel(ValType* dst, const ValType* src, ValType c, uint32_t count) {
+			static const bool ssse3 = GF_BINARY_CPU_HAS_SSSE3();
+			if (!ssse3 || count<MIN_KERNEL_COUNT) {
+				return 0;
+			}
+			return MulAddSsse3(dst, src, c, count);
+		}
+		GF_BINARY_SSSE3_TARGET static uint32_t MulAddSsse3(uint8_t* dst, const uint8_t* src, uint8_t c, uint32_t count) {
+			uint8_t lo[16], hi[16];
+			for (uint32_t i = 0; i<16; i++) {
+				lo[i] = Mul(c, (uint8_t)i);
+				hi[i] = Mul(c, (uint8_t)(i << 4));
+			}
+			const __m128i table_lo = _mm_loadu_si128((const __m128i*)lo);
+			const __m128i table_hi = _mm_loadu_si128((const __m128i*)hi);
+			const __m128i mask = _mm_set1_epi8(0x0f);
+
+			uint32_t i = 0;
+			for (; i + 16 <= count; i += 16) {
+				__m128i x = _mm_loadu_si128((const __m128i*)&src[i]);
+				__m128i p = _mm_xor_si128(
+					_mm_shuffle_epi8(table_lo, _mm_and_si128(x, mask)),
+					_mm_shuffle_epi8(table_hi, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+				_mm_storeu_si128((__m128i*)&dst[i], _mm_xor_si128(_mm_loadu_si128((const __m128i*)&dst[i]), p));
+			}
+			return i;
+		}
+		GF_BINARY_SSSE3_TARGET static uint32_t MulAddSsse3(uint16_t* dst, const uint16_t* src, uint16_t c, uint32_t count) {
+			//table k maps nibble k of x to the low and high byte of c*(nibble<<4k)
+			uint8_t lo[4][16], hi[4][16];
+			for (uint32_t k = 0; k<4; k++) {
+				for (uint32_t i = 0; i<16; i++) {
+					uint16_t v = Mul(c, (uint16_t)(i << (4 * k)));
+					lo[k][i] = (uint8_t)v;
+					hi[k][i] = (uint8_t)(v >> 8);
+				}
+			}
+			__m128i table_lo[4], table_hi[4];
+			for (uint32_t k = 0; k<4; k++) {
+				table_lo[k] = _mm_loadu_si128((const __m128i*)lo[k]);
+				table_hi[k] = _mm_loadu_si128((const __m128i*)hi[k]);
+			}
+			const __m128i mask = _mm_set1_epi8(0x0f);
+			const __m128i split = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+
+			uint32_t i = 0;
+			for (; i + 16 <= count; i += 16) {
+				//16 words as their 16 low bytes and their 16 high bytes
+				__m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&src[i]), split);
+				__m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)&src[i + 8]), split);
+				__m128i x_lo = _mm_unpacklo_epi64(a, b);
+				__m128i x_hi = _mm_unpackhi_epi64(a, b);
+				__m128i n[4] = {
+					_mm_and_si128(x_lo, mask),
+					_mm_and_si128(_mm_srli_epi64(x_lo, 4), mask),
+					_mm_and_si128(x_hi, mask),
+					_mm_and_si128(_mm_srli_epi64(x_hi, 4), mask),
+				};
+				__m128i p_lo = _mm_setzero_si128();
+				__m128i p_hi = _mm_setzero_si128();
+				for (uint32_t k = 0; k<4; k++) {
+					p_lo = _mm_xor_si128(p_lo, _mm_shuffle_epi8(table_lo[k], n[k]));
+					p_hi = _mm_xor_si128(p_hi, _mm_shuffle_epi8(table_hi[k], n[k]));
+				}
+				_mm_storeu_si128((__m128i*)&dst[i], _mm_xor_si128(_mm_loadu_si128((const __m128i*)&dst[i]), _mm_unpacklo_epi8(p_lo, p_hi)));
+				_mm_storeu_si128((__m128i*)&dst[i + 8], _mm_xor_si128(_mm_loadu_si128((const __m128i*)&dst[i + 8]), _mm_unpackhi_epi8(p_lo, p_hi)));
+			}
+			return i;
+		}
+#else
+		static uint32_t MulAddKernel(ValType* /*dst*/, const ValType* /*src*/, ValType /*c*/, uint32_t /*count*/) {
+			return 0;
+		}
+#endif
+	private:
+		//the tables are hit at random, keep them on huge pages, never freed
+		static CGFBinary* GetInstance() {
+			static CGFBinary* gf = new(AllocTables()) CGFBinary;
+			return gf;
+		}
+		static void* AllocTables() {
+			void* p = MemPool::AllocLarge(sizeof(CGFBinary));
+			if (p == nullptr) {
+				throw std::bad_alloc();
+			}
+			return p;
+		}
+		CGFBinary() {
+			uint32_t x = 1;
+			for (uint32_t i = 0; i<PhiQ * 2; i++) {
+				m_pFMap[i] = (ValType)x;
+				x <<= 1;
+				if (x & Q) {
+					x ^= POLY;
+				}
+			}
+			//////////////////////////////////////////////////////////////////////////
+			m_pIMap[0] = -1;
+			for (uint32_t i = 0; i<PhiQ; i++) m_pIMap[m_pFMap[i]] = i;
+		}
+	};
+
+
+	// Reed-Solomon over GF(2^8)/GF(2^16), systematic, generator roots x^1..x^(T2+1)
+	// the code is one word shorter than the prime field one: N-1 words, T2+1 of them parity,
+	// so K = N-T2-2 data words, which is just what a line of the same ECC_PARAM holds
+	// arrECC[i] is the coefficient of x^i, data word k the one of x^(T2+1+k)
+	// encoding and the syndrome check are a division by the generator, both run on CGFBinary::MulAdd
+	template<typename _CodeWordType>
+	class CBinaryReedSolomonCoder :public IReedSolomonCoder2<_CodeWordType>
+	{
+	protected:
+		typedef _CodeWordType                           CodeWordType;
+		typedef IReedSolomonCoder2<_CodeWordType>       IBaseCoder;
+		typedef CGFBinary<_CodeWordType>                CGF;
+
+	public:
+		const uint32_t T;
+		const uint32_t T2;
+		const uint32_t NSym;	//parity words
+		const uint32_t K;		//data words at most
+
+		enum :uint32_t {
+			N = IBaseCoder::N,
+		};
+	protected:
+		std::vector<CodeWordType> G;	//generator, highest degree first, G[0]=1
+
+		static std::vector<CodeWordType>& GetBuffer()
+		{
+			thread_local static std::vector<CodeWordType> buff;
+			return buff;
+		}
+
+		static CodeWordType* DataAt(CodeWordType arrData[], uint32_t uiIndex, uint32_t uiChunkLength, size_t uiChunkStride)
+		{
+			return (CodeWordType*)((uint8_t*)arrData + (uiIndex / uiChunkLength)*uiChunkStride) + uiIndex%uiChunkLength;
+		}
+
+		//B=the received word highest degree first (arrECC nullptr for zero parity) modulo G,
+		//the remainder is left in B[uiDataCount]->B[uiDataCount+NSym-1], highest degree first
+		//return true when it is zero
+		bool Remainder(std::vector<CodeWordType>& B, const CodeWordType arrData[], uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, const CodeWordType arrECC[])const
+		{
+			assert(uiDataCount <= K);
+			B.resize(uiDataCount + NSym);
+			uint32_t k = 0;
+			for (const uint8_t* pChunk = (const uint8_t*)arrData; k<uiDataCount; pChunk += uiChunkStride) {
+				const CodeWordType* p = (const CodeWordType*)pChunk;
+				uint32_t n = std::min(uiChunkLength, uiDataCount - k);
+				for (uint32_t i = 0; i<n; i++) {
+					B[uiDataCount - 1 - (k + i)] = p[i];
+				}
+				k += n;
+			}
+			for (uint32_t i = 0; i<NSym; i++) {
+				B[uiDataCount + i] = (arrECC != nullptr) ? arrECC[NSym - 1 - i] : 0;
+			}
+
+			for (uint32_t i = 0; i<uiDataCount; i++) {
+				CGF::MulAdd(&B[i + 1], &G[1], B[i], NSym);
+			}
+
+			CodeWordType any = 0;
+			for (uint32_t i = 0; i<NSym; i++) {
+				any |= B[uiDataCount + i];
+			}
+			return any == 0;
+		}
+
+		//p(x), highest degree first, at x=a
+		static CodeWordType Horner(const CodeWordType* p, uint32_t uiCount, CodeWordType a)
+		{
+			CodeWordType s = 0;
+			for (uint32_t i = 0; i<uiCount; i++) {
+				s = CGF::Mul(s, a) ^ p[i];
+			}
+			return s;
+		}
+
+		//p(x), lowest degree first, at x=a
+		static CodeWordType Eval(const std::vector<CodeWordType>& p, CodeWordType a)
+		{
+			CodeWordType s = 0;
+			for (uint32_t i = (uint32_t)p.size(); i-- != 0;) {
+				s = CGF::Mul(s, a) ^ p[i];
+			}
+			return s;
+		}
+
+		//Berlekamp-Massey, the error locator of syndromes S[0]->S[NSym-1], lowest degree first
+		void Locator(const std::vector<CodeWordType>& S, std::vector<CodeWordType>& Lambda)const
+		{
+			std::vector<CodeWordType> C(NSym + 1, 0), B(NSym + 1, 0), Tmp;
+			C[0] = B[0] = 1;
+			uint32_t L = 0, m = 1;
+			CodeWordType b = 1;
+			for (uint32_t n = 0; n<NSym; n++) {
+				CodeWordType d = S[n];
+				for (uint32_t i = 1; i <= L; i++) {
+					d ^= CGF::Mul(C[i], S[n - i]);
+				}
+				if (d == 0) {
+					m++;
+					continue;
+				}
+				CodeWordType coef = CGF::Div(d, b);
+				if (2 * L <= n) {
+					Tmp = C;
+					for (uint32_t i = 0; i + m <= NSym; i++) {
+						C[i + m] ^= CGF::Mul(coef, B[i]);
+					}
+					L = n + 1 - L;
+					B = std::move(Tmp);
+					b = d;
+					m = 1;
+				}
+				else {
+					for (uint32_t i = 0; i + m <= NSym; i++) {
+						C[i + m] ^= CGF::Mul(coef, B[i]);
+					}
+					m++;
+				}
+			}
+			C.resize(L + 1);
+			Lambda = std::move(C);
+		}
+
+		virtual bool Init()
+		{
+			if (G.empty())
+			{
+				//G=Mul{i=1->NSym}(x-a^i), lowest degree first while building
+				std::vector<CodeWordType> g(1, 1);
+				for (uint32_t i = 1; i <= NSym; i++) {
+					CodeWordType root = CGF::Exp(i);
+					g.push_back(0);
+					for (uint32_t j = (uint32_t)g.size() - 1; j>0; j--) {
+						g[j] = g[j - 1] ^ CGF::Mul(g[j], root);
+					}
+					g[0] = CGF::Mul(g[0], root);
+				}
+				G.assign(g.rbegin(), g.rend());
+			}
+			return true;
+		}
+
+	public:
+		CBinaryReedSolomonCoder(uint32_t _T) :T(_T), T2(T * 2), NSym(T2 + 1), K(N - 1 - NSym) {
+			static_assert(N == 0x10000 || N == 0x100, "code length N does not match 8bit or 16bit!");
+			assert(N>NSym + 1);
+		}
+
+		virtual void EncodeT2(const CodeWordType arrData[/*N-(T*2+2)*/], CodeWordType arrECC[/*T*2+1*/])const
+		{
+			EncodeS2(arrData, K, K, 0, arrECC);
+		}
+
+		virtual uint32_t DecodeT2(CodeWordType arrData[/*N-(T*2+2)*/], const CodeWordType arrECC[/*T*2+1*/])const
+		{
+			return DecodeS2(arrData, K, K, 0, arrECC);
+		}
+
+		virtual void EncodeS2(const CodeWordType arrData[], uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, CodeWordType arrECC[/*T*2+1*/])const
+		{
+			assert(!G.empty());//Init() first
+
+			std::vector<CodeWordType>& B = GetBuffer();
+			Remainder(B, arrData, uiDataCount, uiChunkLength, uiChunkStride, nullptr);
+			for (uint32_t i = 0; i<NSym; i++) {
+				arrECC[i] = B[uiDataCount + NSym - 1 - i];
+			}
+		}
+
+		virtual bool CheckS2(const CodeWordType arrData[], uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, const CodeWordType arrECC[/*T*2+1*/])const
+		{
+			return Remainder(GetBuffer(), arrData, uiDataCount, uiChunkLength, uiChunkStride, arrECC);
+		}
+
+		virtual uint32_t DecodeS2(CodeWordType arrData[], uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, const CodeWordType arrECC[/*T*2+1*/])const
+		{
+			std::vector<CodeWordType>& B = GetBuffer();
+			if (Remainder(B, arrData, uiDataCount, uiChunkLength, uiChunkStride, arrECC)) {
+				return IReedSolomonCoder::ECC_NOERROR;
+			}
+			//////////////////////////////////////////////////////////////////////////
+			//G(a^i)=0, so the syndromes are the remainder at a^1->a^NSym
+			std::vector<CodeWordType> S(NSym);
+			for (uint32_t i = 0; i<NSym; i++) {
+				S[i] = Horner(&B[uiDataCount], NSym, CGF::Exp(i + 1));
+			}
+			std::vector<CodeWordType> Lambda;
+			Locator(S, Lambda);
+			uint32_t L = (uint32_t)Lambda.size() - 1;
+			if (L>T) {
+				return IReedSolomonCoder::ECC_FAILED;
+			}
+			//Omega=S*Lambda mod x^NSym, Lambda_ its derivative, only the odd terms are left
+			std::vector<CodeWordType> Omega(NSym, 0);
+			for (uint32_t i = 0; i<NSym; i++) {
+				for (uint32_t j = 0; j <= L && i + j<NSym; j++) {
+					Omega[i + j] ^= CGF::Mul(S[i], Lambda[j]);
+				}
+			}
+			std::vector<CodeWordType> Lambda_(std::max(L, 1u), 0);
+			for (uint32_t i = 1; i <= L; i += 2) {
+				Lambda_[i - 1] = Lambda[i];
+			}
+
+			//Chien search over the positions that exist, an error at x^pos makes Lambda(a^-pos) zero
+			std::vector<CodeWordType> ecc(arrECC, arrECC + NSym);
+			uint32_t uiPosCount = NSym + uiDataCount;
+			uint32_t uiFound = 0;
+			for (uint32_t pos = 0; pos<uiPosCount && uiFound<L; pos++) {
+				CodeWordType Xinv = CGF::Exp((CGF::PhiQ - pos) % CGF::PhiQ);
+				if (Eval(Lambda, Xinv) != 0) {
+					continue;
+				}
+				CodeWordType d = Eval(Lambda_, Xinv);
+				if (d == 0) {
+					return IReedSolomonCoder::ECC_FAILED;//a repeated root, not an error pattern we can fix
+				}
+				uiFound++;
+				CodeWordType e = CGF::Div(Eval(Omega, Xinv), d);
+				if (pos<NSym) {
+					ecc[pos] ^= e;
+				}
+				else {
+					*DataAt(arrData, pos - NSym, uiChunkLength, uiChunkStride) ^= e;
+				}
+			}
+			//////////////////////////////////////////////////////////////////////////
+			if (uiFound != L || !Remainder(B, arrData, uiDataCount, uiChunkLength, uiChunkStride, ecc.data())) {
+				return IReedSolomonCoder::ECC_FAILED;
+			}
+			//////////////////////////////////////////////////////////////////////////
+			return IReedSolomonCoder::ECC_SUCCESS;
+		}
+
+		//outArr is the codeword in order: T2+1 parity words, K data words, then one unused 0
+		virtual void EncodeF2(const CodeWordType inArr[/*N-(T*2+2)*/], CodeWordType outArr[/*N*/])const
+		{
+			EncodeS2(inArr, K, K, 0, outArr);
+			for (uint32_t i = 0; i<K; i++) {
+				outArr[NSym + i] = inArr[i];
+			}
+			outArr[N - 1] = 0;
+		}
+
+		virtual uint32_t DecodeF2(const CodeWordType inArr[/*N*/], CodeWordType outArr[/*N-(T*2+2)*/])const
+		{
+			for (uint32_t i = 0; i<K; i++) {
+				outArr[i] = inArr[NSym + i];
+			}
+			return DecodeS2(outArr, K, K, 0, inArr);
+		}
+	};
+};
+
+
+#endif
@@ -0,0 +1,167 @@
+#pragma once
+
+#ifndef _BUFFERCODER_HPP_
+#define _BUFFERCODER_HPP_
+
+#include "FileCoder.hpp"
+
+// the file coder on data already in memory: a list of buffers of the caller, as struct iovec,
+// taken end to end as one file and laid out in stripes by the same ECC_PARAM
+// the parity goes to memory of the caller, it is the ecc file without its header
+// a stripe lying in one buffer is coded where it is and its parity is written where it belongs,
+// only a stripe across two buffers, or the short last one, is gathered into the round first
+class CEccBufferCoder :public CEccFileCoder
+{
+public:
+	typedef FileIO::IO_VECTOR IO_VECTOR;
+protected:
+	typedef FileIO::CIoVectorReader CIoVectorReader;
+	typedef FileIO::CIoVectorWriter CIoVectorWriter;
+
+	static uint64_t GetDataLength(const IO_VECTOR* data, size_t count) {
+		uint64_t length = 0;
+		for (size_t i = 0; i<count; i++) {
+			length += data[i].uiLength;
+		}
+		return length;
+	}
+
+	//one task over the buffers, the parity at its offset in the ecc file
+	bool CodeBuffers(
+		const IO_VECTOR* data,
+		size_t count,
+		const IO_VECTOR& parity,
+		const ECC_PARAM& ecc_param,
+		bool bDecode,
+		uint32_t& result,
+		ECC_CALLBACK_FUNC func,
+		uint32_t thread_count)
+	{
+		uint64_t length = GetDataLength(data, count);
+		if (parity.uiLength<GetParityLength(ecc_param, length)) {
+			return false;
+		}
+		StartWorkerPool(thread_count);
+		StartReporter(func);
+
+		CODER_ROUND round;
+		ResetRound(round, ecc_param);
+
+		std::unique_ptr<FILE_TASK> pTask(new FILE_TASK);
+		pTask->raw_reader.reset(new CIoVectorReader(data, count));
+		if (bDecode) {
+			pTask->ecc_reader.reset(new CIoVectorReader(&parity, 1, CReedSolomonCoder8::N));
+			pTask->writer.reset(new CIoVectorWriter(data, count));
+		}
+		else {
+			pTask->writer.reset(new CIoVectorWriter(&parity, 1, CReedSolomonCoder8::N));
+		}
+		pTask->ecc_param = ecc_param;
+		pTask->ui64FileLength = length;
+		pTask->ui64EccOffset = CReedSolomonCoder8::N;
+		pTask->bWriteAt = true;
+		pTask->bStreaming = false;
+		pTask->bQueued = false;
+		pTask->bFailed = false;
+		pTask->ui32Result = IReedSolomonCoder::ECC_NOERROR;
+
+		//kept here instead of in round.vTask, its result is still needed after the flush
+		bool bBreak = false;
+		bool bError = !QueueFile(round, pTask.get(), bBreak);
+		if (!FlushRound(round, bBreak)) {
+			bError = true;
+		}
+		if (pTask->bFailed || !pTask->writer->Close()) {
+			bError = true;
+		}
+		result = pTask->ui32Result;
+		m_pReporter.reset();
+		return !bError && !bBreak;
+	}
+public:
+	// parity bytes of length bytes of data
+	static uint64_t GetParityLength(const ECC_PARAM& ecc_param, uint64_t length) {
+		return GetEccLength(ecc_param, length) - CReedSolomonCoder8::N;
+	}
+
+	// encode data[0..count), taken end to end, parity gets GetParityLength bytes
+	bool EncodeBuffers(
+		const IO_VECTOR* data,
+		size_t count,
+		void* parity,
+		uint64_t parity_length,
+		const ECC_PARAM& ecc_param,
+		ECC_CALLBACK_FUNC func = nullptr,
+		uint32_t thread_count = 0/* 0 for the tuned count, all cpu untuned */)
+	{
+		IO_VECTOR parity_vector = { parity, (size_t)parity_length };
+		uint32_t result;
+		return CodeBuffers(data, count, parity_vector, ecc_param, false, result, func, thread_count);
+	}
+
+	bool EncodeBuffer(
+		const void* data,
+		uint64_t length,
+		void* parity,
+		uint64_t parity_length,
+		const ECC_PARAM& ecc_param,
+		ECC_CALLBACK_FUNC func = nullptr,
+		uint32_t thread_count = 0/* 0 for the tuned count, all cpu untuned */)
+	{
+		IO_VECTOR data_vector = { const_cast<void*>(data), (size_t)length };
+		return EncodeBuffers(&data_vector, 1, parity, parity_length, ecc_param, func, thread_count);
+	}
+
+	// check data[0..count) against its parity and repair it in place
+	// result is the worst of the lines: ECC_NOERROR, ECC_SUCCESS when something was repaired,
+	// ECC_FAILED when a line could not be, the callback gets each of those lines as with CheckEccFile
+	// return false if the parity is too short or the callback asked to stop
+	bool CheckBuffers(
+		const IO_VECTOR* data,
+		size_t count,
+		const void* parity,
+		uint64_t parity_length,
+		const ECC_PARAM& ecc_param,
+		uint32_t& result,
+		ECC_CALLBACK_FUNC func = nullptr,
+		uint32_t thread_count = 0/* 0 for the tuned count, all cpu untuned */)
+	{
+		IO_VECTOR parity_vector = { const_cast<void*>(parity), (size_t)parity_length };
+		return CodeBuffers(data, count, parity_vector, ecc_param, true, result, func, thread_count);
+	}
+
+	bool CheckBuffer(
+		void* data,
+		uint64_t length,
+		const void* parity,
+		uint64_t parity_length,
+		const ECC_PARAM& ecc_param,
+		uint32_t& result,
+		ECC_CALLBACK_FUNC func = nullptr,
+		uint32_t thread_count = 0/* 0 for the tuned count, all cpu untuned */)
+	{
+		IO_VECTOR data_vector = { data, (size_t)length };
+		return CheckBuffers(&data_vector, 1, parity, parity_length, ecc_param, result, func, thread_count);
+	}
+
+	// encode the length bytes at data, ecc gets the bytes CreateEccFile would write to the ecc file,
+	// GetEccFileLength of them, ecc_length is the room there is
+	bool CreateEccBuffer(
+		const void* data,
+		uint64_t length,
+		void* ecc,
+		uint64_t ecc_length,
+		const ECC_PARAM& ecc_param,
+		ECC_CALLBACK_FUNC func = nullptr,
+		uint32_t thread_count = 0/* 0 for the tuned count, all cpu untuned */)
+	{
+		if (ecc_length<CReedSolomonCoder8::N) {
+			return false;
+		}
+		EncodeEccHeader(ecc_param, length, (uint8_t*)ecc);
+		return EncodeBuffer(data, length, (uint8_t*)ecc + CReedSolomonCoder8::N, ecc_length - CReedSolomonCoder8::N, ecc_param, func, thread_count);
+	}
+};
+
+
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+
+#ifndef _CRC32_HPP_
+#define _CRC32_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace ErrorDetectingCodes
+{
+
+	// crc32 of zlib/png (reflected 0xEDB88320), eight bytes a step with eight tables
+	// Calc(b, Calc(a)) is the crc of a followed by b
+	class CCrc32
+	{
+	public:
+		enum :uint32_t {
+			POLY = 0xEDB88320,
+		};
+
+		static uint32_t Calc(const uint8_t* pData, size_t uiLength, uint32_t uiCrc = 0) {
+			static const CCrc32 tables;
+			const uint32_t(*T)[256] = tables.m_pTables;
+
+			uint32_t c = ~uiCrc;
+			for (; uiLength >= 8; uiLength -= 8, pData += 8) {
+				uint32_t lo = c ^ ((uint32_t)pData[0] | (uint32_t)pData[1] << 8 | (uint32_t)pData[2] << 16 | (uint32_t)pData[3] << 24);
+				uint32_t hi = (uint32_t)pData[4] | (uint32_t)pData[5] << 8 | (uint32_t)pData[6] << 16 | (uint32_t)pData[7] << 24;
+				c = T[7][lo & 0xff] ^ T[6][(lo >> 8) & 0xff] ^ T[5][(lo >> 16) & 0xff] ^ T[4][lo >> 24] ^
+					T[3][hi & 0xff] ^ T[2][(hi >> 8) & 0xff] ^ T[1][(hi >> 16) & 0xff] ^ T[0][hi >> 24];
+			}
+			for (; uiLength>0; uiLength--, pData++) {
+				c = T[0][(c ^ *pData) & 0xff] ^ (c >> 8);
+			}
+			return ~c;
+		}
+	protected:
+		uint32_t m_pTables[8][256];
+
+		CCrc32() {
+			for (uint32_t i = 0; i<256; i++) {
+				uint32_t c = i;
+				for (uint32_t k = 0; k<8; k++) {
+					c = (c & 1) ? (c >> 1) ^ POLY : (c >> 1);
+				}
+				m_pTables[0][i] = c;
+			}
+			for (uint32_t i = 0; i<256; i++) {
+				for (uint32_t t = 1; t<8; t++) {
+					m_pTables[t][i] = (m_pTables[t - 1][i] >> 8) ^ m_pTables[0][m_pTables[t - 1][i] & 0xff];
+				}
+			}
+		}
+	};
+};
+
+
+#endif
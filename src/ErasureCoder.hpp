@@ -0,0 +1,365 @@
+#pragma once
+
+#ifndef _ERASURECODER_HPP_
+#define _ERASURECODER_HPP_
+
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "Bit.hpp"
+#include "ReedSolomonCoder.hpp"
+
+namespace ErrorCorrectingCodes
+{
+
+	// systematic MDS erasure code over GF(65537) across whole rows of 16 bits words, for recovery volumes:
+	// M recovery rows rebuild any M lost rows of the K+M, as long as it is known which ones are lost
+	// word j of every row makes one codeword c, position p holds recovery row p for p<M and data row p-M after,
+	// the positions from K+M up to the transform length N are 0, and c(w^1)->c(w^M) are 0 for w of order N
+	// a recovery word may be 65536, its 17th bit is kept in a bitmap next to the row like CFNT::PACKED_ARRAY does
+	class CErasureCoder
+	{
+	public:
+		typedef ErrorCorrectingCodes::CFNT<4>	CFNT;
+		typedef CFNT::CGFPrime					CGFPrime;
+		typedef CGFPrime::NumType				NumType;
+
+		enum :uint32_t {
+			MaxPositions = CFNT::MaxN,
+			HIGH_VALUE = CFNT::MaxN,	//the one value of the field above 16 bits
+			TILE_WORDS = 256,			//words of a row summed at once by the direct rebuild
+			ROW_GROUP = 4,				//rows summed in one pass over a tile
+			FNT_COST = 16,				//a butterfly on NumType against a multiply-add of the direct rebuild
+			NAIVE_PRODUCT = 64,			//roots multiplied out one by one below that
+		};
+
+		const uint32_t K;	//data rows
+		const uint32_t M;	//recovery rows
+		const uint32_t N;	//transform length, a power of 2 not below K+M
+	protected:
+		std::vector<uint32_t> m_vErased;	//positions to rebuild, in the order of SetErasures
+		std::vector<uint32_t> m_vKnown;		//every other position below K+M
+		bool m_bDirect;
+
+		//direct: word of erasure e = sum of m_vCoeffs[e*known+i]*word of m_vKnown[i]
+		std::vector<uint32_t> m_vCoeffs;
+
+		//transforms: Omega=S*Lambda mod x^M from the syndromes S, word of erasure e = Omega(X_e^-1)/Lambda'(X_e^-1)
+		uint32_t m_uiN2;						//length of the S*Lambda product
+		std::vector<NumType> m_vEvalLambda;	//Lambda transformed to m_uiN2, bit reversed order
+		std::vector<NumType> m_vInvLambda_;	//1/Lambda'(X_e^-1) for every erasure
+
+		BIT_INLINE NumType X(uint32_t uiPosition)const {
+			return CGFPrime::Exp((CFNT::MaxN / N)*uiPosition);
+		}
+
+		BIT_INLINE static bool GetHigh(const uint8_t* pHigh, uint32_t i) {
+			return ((pHigh[i >> 3] >> (i & 7)) & 1) != 0;
+		}
+
+		BIT_INLINE static void SetHigh(uint8_t* pHigh, uint32_t i, bool bHigh) {
+			uint8_t bit = (uint8_t)(1 << (i & 7));
+			pHigh[i >> 3] = bHigh ? (pHigh[i >> 3] | bit) : (pHigh[i >> 3] & ~bit);
+		}
+
+		static uint32_t NextPow2(uint32_t x) {
+			uint32_t n = 1;
+			while (n<x) n <<= 1;
+			return n;
+		}
+
+		//Mul{i<uiCount}(x-pRoots[i]), lowest degree first
+		//halves are multiplied with transforms, so a few thousand erasures cost no more than a few rows
+		static std::vector<NumType> RootProduct(const NumType* pRoots, uint32_t uiCount)
+		{
+			std::vector<NumType> P(uiCount + 1, CGFPrime::ZeroElement());
+			if (uiCount <= NAIVE_PRODUCT) {
+				P[0] = CGFPrime::UnitElement();
+				for (uint32_t i = 0; i<uiCount; i++) {
+					for (uint32_t j = i + 1; j>0; j--) {
+						P[j] = P[j - 1] - pRoots[i] * P[j];
+					}
+					P[0] = CGFPrime::ZeroElement() - pRoots[i] * P[0];
+				}
+				return P;
+			}
+			uint32_t h = uiCount / 2;
+			std::vector<NumType> A = RootProduct(pRoots, h);
+			std::vector<NumType> B = RootProduct(pRoots + h, uiCount - h);
+			uint32_t n = NextPow2(uiCount + 1);
+			A.resize(n, CGFPrime::ZeroElement());
+			B.resize(n, CGFPrime::ZeroElement());
+			CFNT::FNT(A.data(), n, false);
+			CFNT::FNT(B.data(), n, false);
+			for (uint32_t i = 0; i<n; i++) {
+				A[i] = A[i] * B[i];
+			}
+			CFNT::IFNT(A.data(), n, false);
+			std::copy(A.begin(), A.begin() + uiCount + 1, P.begin());
+			return P;
+		}
+
+		//A evaluated at w^0->w^(N-1), natural order
+		std::vector<NumType> EvalAll(const std::vector<NumType>& A)const
+		{
+			assert(A.size() <= N);
+			std::vector<NumType> B(A);
+			B.resize(N, CGFPrime::ZeroElement());
+			CFNT::FNT(B.data(), N, true);
+			return B;
+		}
+
+		static std::vector<NumType> Der(const std::vector<NumType>& A)
+		{
+			std::vector<NumType> B(A.size()>1 ? A.size() - 1 : 1, CGFPrime::ZeroElement());
+			for (uint32_t i = 1; i<A.size(); i++) {
+				B[i - 1] = A[i] * CGFPrime::Num(i%CGFPrime::P);
+			}
+			return B;
+		}
+
+		static std::vector<NumType>& GetBuffer(uint32_t uiIndex)
+		{
+			thread_local static std::vector<NumType> buff[2];
+			return buff[uiIndex];
+		}
+
+		//lo+=sum of c[k]*r[k]&0xffff, hi+=sum of c[k]*r[k]>>16, four rows for one pass over lo and hi
+		//called with a constant uiCount for whole tiles, the loop is then vectorized at -O2 as well
+		BIT_INLINE static void SumRows(uint32_t* lo, uint32_t* hi, const uint16_t* const r[ROW_GROUP], const uint16_t c[ROW_GROUP], uint32_t uiCount)
+		{
+			for (uint32_t t = 0; t<uiCount; t++) {
+				uint32_t v0 = (uint32_t)c[0] * r[0][t];
+				uint32_t v1 = (uint32_t)c[1] * r[1][t];
+				uint32_t v2 = (uint32_t)c[2] * r[2][t];
+				uint32_t v3 = (uint32_t)c[3] * r[3][t];
+				lo[t] += (v0 & 0xffff) + (v1 & 0xffff) + (v2 & 0xffff) + (v3 & 0xffff);
+				hi[t] += (v0 >> 16) + (v1 >> 16) + (v2 >> 16) + (v3 >> 16);
+			}
+		}
+
+		void RebuildDirect(const uint16_t* const ppRows[], const uint8_t* const ppHigh[], uint16_t* const ppOut[], uint8_t* const ppOutHigh[], uint32_t uiBegin, uint32_t uiEnd)const
+		{
+			//P=2^16+1: a product p is p&0xffff-(p>>16), the two halves are summed apart in 32 bits
+			//and folded once at the end, no more than 65536 halves of 16 bits each
+			static const uint16_t zeros[TILE_WORDS] = { 0 };
+			uint32_t lo[TILE_WORDS], hi[TILE_WORDS];
+			uint32_t uiKnown = (uint32_t)m_vKnown.size();
+			for (uint32_t uiTile = uiBegin; uiTile<uiEnd; uiTile += TILE_WORDS) {
+				uint32_t n = std::min<uint32_t>(TILE_WORDS, uiEnd - uiTile);
+				for (uint32_t e = 0; e<m_vErased.size(); e++) {
+					if (ppOut[e] == nullptr) {
+						continue;
+					}
+					std::fill(lo, lo + n, 0);
+					std::fill(hi, hi + n, 0);
+					const uint32_t* pCoeffs = &m_vCoeffs[(size_t)e*uiKnown];
+					for (uint32_t i = 0; i<uiKnown; i += ROW_GROUP) {
+						const uint16_t* r[ROW_GROUP];
+						uint16_t c[ROW_GROUP];
+						for (uint32_t k = 0; k<ROW_GROUP; k++) {
+							//65536=-1 and the rows past the end take no part in the products
+							bool bRow = i + k<uiKnown && pCoeffs[i + k] != HIGH_VALUE;
+							r[k] = bRow ? ppRows[m_vKnown[i + k]] + uiTile : zeros;
+							c[k] = bRow ? (uint16_t)pCoeffs[i + k] : 0;
+						}
+						if (n == TILE_WORDS) {
+							SumRows(lo, hi, r, c, TILE_WORDS);
+						}
+						else {
+							SumRows(lo, hi, r, c, n);
+						}
+					}
+					for (uint32_t i = 0; i<uiKnown; i++) {
+						uint32_t c = pCoeffs[i];
+						uint32_t p = m_vKnown[i];
+						const uint16_t* r = ppRows[p] + uiTile;
+						if (c == HIGH_VALUE) {
+							for (uint32_t t = 0; t<n; t++) hi[t] += r[t];
+						}
+						if (ppHigh[p] != nullptr && c != 0) {
+							//a stored 0 may be 65536=-1, the bitmap is almost all zero bytes
+							for (uint32_t t = 0; t<n; t += 8) {
+								if (ppHigh[p][(uiTile + t) >> 3] == 0) {
+									continue;
+								}
+								for (uint32_t u = t; u<std::min(t + 8, n); u++) {
+									if (r[u] == 0 && GetHigh(ppHigh[p], uiTile + u)) {
+										if (c == HIGH_VALUE) lo[u] += 1;
+										else hi[u] += c;
+									}
+								}
+							}
+						}
+					}
+					uint16_t* pOut = ppOut[e] + uiTile;
+					for (uint32_t t = 0; t<n; t++) {
+						uint32_t v = (uint32_t)(((uint64_t)lo[t] + (uint64_t)CGFPrime::P*0x10000 - hi[t]) % CGFPrime::P);
+						pOut[t] = (uint16_t)v;
+						if (ppOutHigh[e] != nullptr) {
+							SetHigh(ppOutHigh[e], uiTile + t, v == HIGH_VALUE);
+						}
+						else {
+							assert(v != HIGH_VALUE);
+						}
+					}
+				}
+			}
+		}
+
+		void RebuildFNT(const uint16_t* const ppRows[], const uint8_t* const ppHigh[], uint16_t* const ppOut[], uint8_t* const ppOutHigh[], uint32_t uiBegin, uint32_t uiEnd)const
+		{
+			std::vector<NumType>& C = GetBuffer(0);
+			std::vector<NumType>& S = GetBuffer(1);
+			C.resize(N);
+			S.resize(std::max(N, m_uiN2));
+			for (uint32_t j = uiBegin; j<uiEnd; j++) {
+				std::fill(C.begin(), C.end(), CGFPrime::ZeroElement());
+				for (uint32_t p : m_vKnown) {
+					uint32_t v = ppRows[p][j];
+					if (v == 0 && ppHigh[p] != nullptr && GetHigh(ppHigh[p], j)) {
+						v = HIGH_VALUE;
+					}
+					C[p] = CGFPrime::Num(v);
+				}
+				//S[i]=c(w^(i+1)), the erased positions left 0
+				CFNT::FNT(C.data(), N, true);
+				std::fill(S.begin(), S.end(), CGFPrime::ZeroElement());
+				std::copy(C.begin() + 1, C.begin() + 1 + M, S.begin());
+				CFNT::FNT(S.data(), m_uiN2, false);
+				for (uint32_t i = 0; i<m_uiN2; i++) {
+					S[i] = S[i] * m_vEvalLambda[i];
+				}
+				CFNT::IFNT(S.data(), m_uiN2, false);
+				std::fill(S.begin() + M, S.begin() + N, CGFPrime::ZeroElement());
+				CFNT::FNT(S.data(), N, true);
+				for (uint32_t e = 0; e<m_vErased.size(); e++) {
+					if (ppOut[e] == nullptr) {
+						continue;
+					}
+					uint32_t v = (S[(N - m_vErased[e]) % N] * m_vInvLambda_[e]).uiValue;
+					ppOut[e][j] = (uint16_t)v;
+					if (ppOutHigh[e] != nullptr) {
+						SetHigh(ppOutHigh[e], j, v == HIGH_VALUE);
+					}
+					else {
+						assert(v != HIGH_VALUE);
+					}
+				}
+			}
+		}
+		//sum of c_i*X_i*f(X_i) is 0 for any f of degree<M, take f=L/(x-X_e), it is 0 at the other erasures:
+		//c_e = -sum over known i of c_i * X_i*L(X_i) / ((X_i-X_e)*X_e*L'(X_e))
+		void PrepareDirect(const std::vector<NumType>& roots, const std::vector<NumType>& L)
+		{
+			m_bDirect = true;
+			m_vEvalLambda.clear();
+			m_vInvLambda_.clear();
+			std::vector<NumType> EvalL = EvalAll(L);
+			std::vector<NumType> EvalL_ = EvalAll(Der(L));
+			size_t uiKnown = m_vKnown.size();
+			m_vCoeffs.resize(roots.size()*uiKnown);
+			std::vector<NumType> a(uiKnown);
+			for (size_t i = 0; i<uiKnown; i++) {
+				a[i] = X(m_vKnown[i])*EvalL[m_vKnown[i]];
+			}
+			for (size_t e = 0; e<roots.size(); e++) {
+				NumType b = CGFPrime::ZeroElement() - CGFPrime::Inv(roots[e] * EvalL_[m_vErased[e]]);
+				for (size_t i = 0; i<uiKnown; i++) {
+					m_vCoeffs[e*uiKnown + i] = (a[i] * b / (X(m_vKnown[i]) - roots[e])).uiValue;
+				}
+			}
+		}
+
+		//Lambda=Mul(1-X_e*x) is L reversed
+		void PrepareFNT(const std::vector<NumType>& L)
+		{
+			m_bDirect = false;
+			m_vCoeffs.clear();
+			m_vInvLambda_.clear();
+			m_uiN2 = NextPow2(M + (uint32_t)m_vErased.size());
+			assert(m_uiN2 <= CFNT::MaxN);
+			std::vector<NumType> Lambda(L.rbegin(), L.rend());
+			m_vEvalLambda = Lambda;
+			m_vEvalLambda.resize(m_uiN2, CGFPrime::ZeroElement());
+			CFNT::FNT(m_vEvalLambda.data(), m_uiN2, false);
+			std::vector<NumType> EvalLambda_ = EvalAll(Der(Lambda));
+			for (uint32_t p : m_vErased) {
+				m_vInvLambda_.push_back(CGFPrime::Inv(EvalLambda_[(N - p) % N]));
+			}
+		}
+	public:
+		CErasureCoder(uint32_t uiDataCount, uint32_t uiRecoveryCount)
+			:K(uiDataCount), M(uiRecoveryCount), N(NextPow2(std::max<uint32_t>(uiDataCount + uiRecoveryCount, 2))), m_bDirect(true), m_uiN2(0) {
+			assert(K>0 && K + M <= MaxPositions);
+		}
+
+		uint32_t GetDataPosition(uint32_t uiDataRow)const { return M + uiDataRow; }
+		uint32_t GetRecoveryPosition(uint32_t uiRecoveryRow)const { return uiRecoveryRow; }
+
+		// the positions of the rows that are lost or not to be read, at most M of them, and less than K+M
+		// Rebuild then writes the word of vErased[e] to ppOut[e]
+		// false if there are more erasures than recovery rows
+		bool SetErasures(const std::vector<uint32_t>& vErased)
+		{
+			if (vErased.size()>M) {
+				return false;
+			}
+			std::vector<bool> erased(K + M, false);
+			for (uint32_t p : vErased) {
+				if (p >= K + M || erased[p]) {
+					return false;
+				}
+				erased[p] = true;
+			}
+			m_vErased = vErased;
+			m_vKnown.clear();
+			for (uint32_t p = 0; p<K + M; p++) {
+				if (!erased[p]) {
+					m_vKnown.push_back(p);
+				}
+			}
+
+			uint32_t uiErased = (uint32_t)m_vErased.size();
+			std::vector<NumType> roots(uiErased);
+			for (uint32_t e = 0; e<uiErased; e++) {
+				roots[e] = X(m_vErased[e]);
+			}
+			//L=Mul(x-X_e)
+			std::vector<NumType> L = RootProduct(roots.data(), uiErased);
+
+			//like CPoly's products, whatever costs less, the transforms win for thousands of erasures
+			uint32_t uiN2 = NextPow2(M + uiErased);
+			uint64_t direct_cost = (uint64_t)uiErased*m_vKnown.size();
+			uint64_t fnt_cost = (uint64_t)FNT_COST*(2 * N*Bit::bit_log2_floor(N) + 2 * uiN2*Bit::bit_log2_floor(uiN2));
+			if (direct_cost <= fnt_cost || uiN2>CFNT::MaxN) {
+				PrepareDirect(roots, L);
+			}
+			else {
+				PrepareFNT(L);
+			}
+			return true;
+		}
+
+		// the words [uiBegin,uiEnd) of the erased rows from those of the known ones
+		// ppRows[p] is row of position p (may be nullptr for erased ones), ppHigh[p] its bitmap or nullptr for a data row,
+		// ppOut[e] receives erasure e (nullptr to skip it), ppOutHigh[e] its bitmap, nullptr for a data row
+		// a bitmap byte holds 8 words, concurrent calls need uiBegin a multiple of 8
+		void Rebuild(const uint16_t* const ppRows[], const uint8_t* const ppHigh[], uint16_t* const ppOut[], uint8_t* const ppOutHigh[], uint32_t uiBegin, uint32_t uiEnd)const
+		{
+			if (m_bDirect) {
+				RebuildDirect(ppRows, ppHigh, ppOut, ppOutHigh, uiBegin, uiEnd);
+			}
+			else {
+				RebuildFNT(ppRows, ppHigh, ppOut, ppOutHigh, uiBegin, uiEnd);
+			}
+		}
+
+		// true when Rebuild sums rows directly, false when it goes through the transforms
+		bool IsDirect()const { return m_bDirect; }
+	};
+};
+
+
+#endif
@@ -4,12 +4,20 @@
 #define _FILECODER_HPP_
 
 #include "ReedSolomonCoder.hpp"
+#include "BinaryReedSolomonCoder.hpp"
+#include "Scheduler.hpp"
+#include "ThreadPool.hpp"
+#include "Progress.hpp"
+#include "FileIO.hpp"
+#include "Tuning.hpp"
 
 #include <tuple>
+#include <atomic>
 #include <string>
 #include <vector>
 #include <thread>
-#include <future>
+#include <memory>
+#include <algorithm>
 #include <fstream>
 #include <memory.h>
 
@@ -18,193 +26,1140 @@ class CEccFileCoder
 public:
 
 	struct ECC_PARAM {
-		uint32_t ui32CodeWordBits;//8 or 16
+		uint32_t ui32CodeWordBits;//8 or 16, | CODEWORD_BINARY_FIELD for GF(2^8)/GF(2^16) instead of GF(257)/GF(65537)
 		uint32_t ui32ChunkSize;
-		uint32_t ui32ChunkCount;	// ChunkSize * ChunkCount = 256b(8bit) or 128kb(16bit)
+		uint32_t ui32ChunkCount;	// ChunkSize * ChunkCount = 256b(8bit) or up to 128kb(16bit), less is a shortened code
 		uint32_t ui32EccCount;	// EccCount < ChunkCount, T = (EccCount-1)/2
 		uint32_t ui32Intertwine;  // I/O once time = (ChunkCount - EccCount)*Intertwine
 	};
 
+	// called from one thread at a time, never from a coding thread:
+	// about every 100ms with the bytes done since the last call (result ECC_NOERROR),
+	// and once for every line that did not decode cleanly, with its own offset and length
+	// total_length is FileIO::UNKNOWN_LENGTH while encoding from a pipe
 	typedef uint32_t(__stdcall *ECC_CALLBACK_FUNC)(uint64_t offset, uint32_t length, uint64_t total_length, uint32_t result);
 
 	enum :uint32_t {
 		CODER_CONTIONUE = 0,
 		CODER_BREAK = 1,
 	};
+
+	enum :uint32_t {
+		CODEWORD_BITS_MASK = 0xff,
+		CODEWORD_BINARY_FIELD = 0x100,
+	};
+
+	typedef std::pair<uint64_t, uint64_t> BYTE_RANGE;	//offset, length
 protected:
 	//	typedef ErrorDetectingCodes::CCrc32 CCrc32;
 	typedef ErrorCorrectingCodes::IReedSolomonCoder				IReedSolomonCoder;
 	typedef ErrorCorrectingCodes::CReedSolomonCoder<uint8_t>	CReedSolomonCoder8;
 	typedef ErrorCorrectingCodes::CReedSolomonCoder<uint16_t>	CReedSolomonCoder16;
+	typedef ErrorCorrectingCodes::CReedSolomonCoderRegistry<uint8_t>	CReedSolomonCoderRegistry8;
+	typedef ErrorCorrectingCodes::CReedSolomonCoderRegistry<uint16_t>	CReedSolomonCoderRegistry16;
+	typedef ErrorCorrectingCodes::CReedSolomonCoderRegistry<uint8_t, ErrorCorrectingCodes::CBinaryReedSolomonCoder<uint8_t>>	CBinaryReedSolomonCoderRegistry8;
+	typedef ErrorCorrectingCodes::CReedSolomonCoderRegistry<uint16_t, ErrorCorrectingCodes::CBinaryReedSolomonCoder<uint16_t>>	CBinaryReedSolomonCoderRegistry16;
+	typedef Scheduler::CWorkStealingScheduler					CWorkStealingScheduler;
+	typedef ThreadPool::CWorkerPool								CWorkerPool;
+	typedef Progress::CProgressReporter							CProgressReporter;
+	typedef FileIO::IFileReader									IFileReader;
+	typedef FileIO::IFileWriter									IFileWriter;
+	typedef MemPool::CLargeBuffer								CLargeBuffer;
 
 	struct ECC_HEADER {
 		char		szSign[4];	//"ecc"
-		char		szCoder[4];	//"rs\x01\x00"
+		char		szCoder[4];	//"rs10", "rb10" for the binary fields, see GetCoderName
 		ECC_PARAM	param;
 		uint64_t	ui64FileLength;
 		//uint32_t ui32Crc32;
 	};
 
+	//left by CreateEccShard behind the parity once its shard is done, slot shard_index, see GetShardRecordOffset
+	struct SHARD_RECORD {
+		char		szSign[4];	//"ecc"
+		char		szCoder[4];	//"shrd"
+		ECC_PARAM	param;
+		uint64_t	ui64FileLength;
+		uint32_t	ui32ShardIndex;
+		uint32_t	ui32ShardCount;
+	};
+
 	enum :uint32_t {
 		ECC_HEADER_CODER_T = (CReedSolomonCoder8::N - sizeof(ECC_HEADER) - 1) / 2,
+		SHARD_RECORD_CODER_T = (CReedSolomonCoder8::N - sizeof(SHARD_RECORD) - 1) / 2,
+		MAX_ROUND_STRIPES = 2,	//full stripes a round holds at most, a tail stripe then codes with the one before
+		REPAIR_BATCH_SIZE = 1,	//damaged lines handed out at a time, a repair costs many syndromes
+		SHORT_FILE_LINES = 16,	//a small file gets chunks that spread it over about this many lines,
+		MIN_SHORT_CHUNK_SIZE = 8,	//short enough for the coder to take them as shortened codewords
+		MERGE_COPY_SIZE = 8 << 20,	//parity copied at a time by MergeEccShards
 	};
 
-	IReedSolomonCoder* CreateEccCoder(const ECC_PARAM& ecc_param) {
+	static uint32_t GetCodeWordSize(const ECC_PARAM& ecc_param) {
+		return (ecc_param.ui32CodeWordBits&CODEWORD_BITS_MASK) / Bit::BITS_PER_UINT8;
+	}
+
+	static const char* GetCoderName(const ECC_PARAM& ecc_param) {
+		return (ecc_param.ui32CodeWordBits&CODEWORD_BINARY_FIELD) ? "rb10" : "rs10";
+	}
 
-		assert(ecc_param.ui32CodeWordBits == 8 || ecc_param.ui32CodeWordBits == 16);
+	//a reader from before the binary fields and the shortened codes takes any header it can decode,
+	//and would code such a file as one of GF(257)/GF(65537) with full lines: the header of a file
+	//it can not read has its parity xored with SealHeader's mask, 2T+1 wrong words, which it refuses as undecodable
+	//the mask is no affine map of GF(257), one would leave the header close to another codeword
+	static bool IsSealedHeader(const ECC_PARAM& ecc_param) {
+		uint32_t bits = ecc_param.ui32CodeWordBits&CODEWORD_BITS_MASK;
+		bool shortened = (uint64_t)ecc_param.ui32ChunkSize*ecc_param.ui32ChunkCount < ((uint64_t)1 << bits)*GetCodeWordSize(ecc_param);
+		return (ecc_param.ui32CodeWordBits&CODEWORD_BINARY_FIELD) != 0 || shortened;
+	}
+
+	//its own inverse
+	static void SealHeader(uint8_t buff[CReedSolomonCoder8::N], uint32_t data_count) {
+		uint32_t seed = 0x9e3779b9;
+		for (uint32_t i = 0; i<CReedSolomonCoder8::N; i++) {
+			seed = seed * 1103515245 + 12345;
+			if (i >= data_count) {
+				buff[i] ^= (uint8_t)(seed >> 23);
+			}
+		}
+	}
+
+	//shared by every file coder in the process, ready to code
+	static const IReedSolomonCoder* GetEccCoder(const ECC_PARAM& ecc_param) {
+
+		uint32_t bits = ecc_param.ui32CodeWordBits&CODEWORD_BITS_MASK;
+		bool binary = (ecc_param.ui32CodeWordBits&CODEWORD_BINARY_FIELD) != 0;
+		assert(bits == 8 || bits == 16);
 		assert(ecc_param.ui32EccCount & 1);
 
-		uint32_t ecc_codeword_size = ecc_param.ui32CodeWordBits / Bit::BITS_PER_UINT8;
+		uint32_t ecc_codeword_size = GetCodeWordSize(ecc_param);
 		uint32_t T = ((ecc_param.ui32EccCount*ecc_param.ui32ChunkSize / ecc_codeword_size) - 2) / 2;
 		if (T == 0) T = 1;
 
-		if (ecc_param.ui32CodeWordBits == 8) {
-			return new CReedSolomonCoder8(T);
+		if (bits == 8) {
+			return binary ? (const IReedSolomonCoder*)CBinaryReedSolomonCoderRegistry8::Get(T) : CReedSolomonCoderRegistry8::Get(T);
 		}
-		if (ecc_param.ui32CodeWordBits == 16) {
-			return new CReedSolomonCoder16(T);
+		if (bits == 16) {
+			return binary ? (const IReedSolomonCoder*)CBinaryReedSolomonCoderRegistry16::Get(T) : CReedSolomonCoderRegistry16::Get(T);
 		}
 		return nullptr;
 	}
 
 	bool WriteEccHeader(
-		std::ofstream& ecc_stream,
+		IFileWriter& ecc_writer,
 		const ECC_PARAM& ecc_param,
 		uint64_t ui64FileLength)
 	{
+		uint8_t buff[CReedSolomonCoder8::N];
+		EncodeEccHeader(ecc_param, ui64FileLength, buff);
+		return ecc_writer.Write(buff, sizeof(buff));
+	}
+
+	void EncodeEccHeader(
+		const ECC_PARAM& ecc_param,
+		uint64_t ui64FileLength,
+		uint8_t buff[CReedSolomonCoder8::N])
+	{
 
 		ECC_HEADER ecc_header;
+		memset(&ecc_header, 0, sizeof(ecc_header));
 		strncpy(ecc_header.szSign, "ecc", 4);
-		strncpy(ecc_header.szCoder, "rs10", 4);
+		strncpy(ecc_header.szCoder, GetCoderName(ecc_param), 4);
 		ecc_header.param = ecc_param;
 		ecc_header.ui64FileLength = ui64FileLength;
 		//ecc_header.ui32Crc32=CCrc32::Calc((uint8_t*)&ecc_header,offsetof(ECC_HEADER, ui32Crc32));
 
-		CReedSolomonCoder8 coder(ECC_HEADER_CODER_T);
-		uint8_t buff[CReedSolomonCoder8::N];
+		const CReedSolomonCoder8& coder = *CReedSolomonCoderRegistry8::Get(ECC_HEADER_CODER_T);
 		memcpy(buff, &ecc_header, sizeof(ecc_header));
 		for (uint32_t i = sizeof(ecc_header); i<coder.K; i++) {
 			buff[i] = 0;
 		}
 		coder.EncodeT2(buff, buff + coder.K);
-		ecc_stream.write((char*)&buff, sizeof(buff));
-		return true;
+		if (IsSealedHeader(ecc_param)) {
+			SealHeader(buff, coder.K);
+		}
 	}
 
 	bool ReadEccHeader(
-		std::ifstream& ecc_stream,
-		ECC_PARAM& ecc_param,
-		uint64_t& ui64FileLength)
+		IFileReader& ecc_reader,
+		uint64_t header_offset,
+		ECC_HEADER& ecc_header)
 	{
-		CReedSolomonCoder8 coder(ECC_HEADER_CODER_T);
+		const CReedSolomonCoder8& coder = *CReedSolomonCoderRegistry8::Get(ECC_HEADER_CODER_T);
 		uint8_t buff[CReedSolomonCoder8::N];
-		ecc_stream.read((char*)&buff, sizeof(buff));
+		if (!ecc_reader.Read(header_offset, sizeof(buff), buff)) {
+			return false;
+		}
 
+		uint8_t sealed[CReedSolomonCoder8::N];
+		memcpy(sealed, buff, sizeof(sealed));
+		if (coder.DecodeT2(buff, buff + coder.K) == IReedSolomonCoder::ECC_FAILED) {
+			memcpy(buff, sealed, sizeof(buff));
+			SealHeader(buff, coder.K);
+			if (coder.DecodeT2(buff, buff + coder.K) == IReedSolomonCoder::ECC_FAILED) {
+				return false;
+			}
+		}
+
+		memcpy(&ecc_header, buff, sizeof(ecc_header));
+		return true;
+	}
+
+	static uint64_t GetShardRecordOffset(const ECC_PARAM& ecc_param, uint64_t file_length, uint32_t shard_index) {
+		return GetEccLength(ecc_param, file_length) + (uint64_t)shard_index*CReedSolomonCoder8::N;
+	}
+
+	void EncodeShardRecord(
+		const ECC_PARAM& ecc_param,
+		uint64_t ui64FileLength,
+		uint32_t shard_index,
+		uint32_t shard_count,
+		uint8_t buff[CReedSolomonCoder8::N])
+	{
+		SHARD_RECORD record;
+		memset(&record, 0, sizeof(record));
+		strncpy(record.szSign, "ecc", 4);
+		memcpy(record.szCoder, "shrd", 4);
+		record.param = ecc_param;
+		record.ui64FileLength = ui64FileLength;
+		record.ui32ShardIndex = shard_index;
+		record.ui32ShardCount = shard_count;
+
+		const CReedSolomonCoder8& coder = *CReedSolomonCoderRegistry8::Get(SHARD_RECORD_CODER_T);
+		memset(buff, 0, CReedSolomonCoder8::N);
+		memcpy(buff, &record, sizeof(record));
+		coder.EncodeT2(buff, buff + coder.K);
+	}
+
+	//false for a slot never written or cleared, its sign does not decode
+	bool ReadShardRecord(
+		IFileReader& ecc_reader,
+		uint64_t record_offset,
+		SHARD_RECORD& record)
+	{
+		const CReedSolomonCoder8& coder = *CReedSolomonCoderRegistry8::Get(SHARD_RECORD_CODER_T);
+		uint8_t buff[CReedSolomonCoder8::N];
+		if (ecc_reader.GetLength() < record_offset + sizeof(buff) || !ecc_reader.Read(record_offset, sizeof(buff), buff)) {
+			return false;
+		}
 		if (coder.DecodeT2(buff, buff + coder.K) == IReedSolomonCoder::ECC_FAILED) {
 			return false;
 		}
+		memcpy(&record, buff, sizeof(record));
+		return strncmp(record.szSign, "ecc", 4) == 0 && strncmp(record.szCoder, "shrd", 4) == 0;
+	}
 
+	bool ReadEccHeader(
+		IFileReader& ecc_reader,
+		ECC_PARAM& ecc_param,
+		uint64_t& ui64FileLength)
+	{
 		ECC_HEADER ecc_header;
-		memcpy(&ecc_header, buff, sizeof(ecc_header));
+		if (!ReadEccHeader(ecc_reader, 0, ecc_header)) {
+			return false;
+		}
+		if (ecc_header.ui64FileLength == FileIO::UNKNOWN_LENGTH) {
+			//encoded from a pipe, the length is in a copy of the header after the parity
+			uint64_t ecc_length = ecc_reader.GetLength();
+			if (ecc_length == FileIO::UNKNOWN_LENGTH || ecc_length < 2 * CReedSolomonCoder8::N) {
+				return false;
+			}
+			ECC_HEADER ecc_trailer;
+			if (!ReadEccHeader(ecc_reader, ecc_length - CReedSolomonCoder8::N, ecc_trailer)) {
+				return false;
+			}
+			if (memcmp(&ecc_trailer.param, &ecc_header.param, sizeof(ECC_PARAM)) != 0) {
+				return false;
+			}
+			ecc_header.ui64FileLength = ecc_trailer.ui64FileLength;
+		}
+
+		//the field is in the name as well, a reader that does not know it stops here
+		if (memcmp(ecc_header.szCoder, GetCoderName(ecc_header.param), sizeof(ecc_header.szCoder)) != 0) {
+			return false;
+		}
 
 		ecc_param = ecc_header.param;
 		ui64FileLength = ecc_header.ui64FileLength;
 		return true;
 	}
 
-	static void ecc_encode(
-		std::tuple<IReedSolomonCoder*, uint32_t> coder_info,
-		std::tuple<uint8_t*, uint32_t, uint32_t, uint32_t> buffer_info,
-		std::tuple<ECC_CALLBACK_FUNC, uint64_t, uint64_t> callback_info,
-		std::promise<uint32_t>&& thread_exitcode)
+	// read [read_offset,read_offset+read_real_length) into buff and pad it with zero up to pad_length
+	static bool ReadStripe(
+		IFileReader& reader,
+		uint8_t* buff,
+		uint64_t read_offset,
+		uint32_t read_real_length,
+		uint32_t pad_length)
+	{
+		if (!reader.Read(read_offset, read_real_length, buff)) {
+			return false;
+		}
+		memset(buff + read_real_length, 0, pad_length - read_real_length);
+		return true;
+	}
+
+	//lines [begin,begin+count) of a stripe whose rows are row_size apart,
+	//row j of buff holds data row j of those lines, line_size = count*chunk_size
+	static bool ReadLines(
+		IFileReader& reader,
+		uint8_t* buff,
+		uint64_t read_offset,
+		uint32_t read_real_length,
+		uint32_t row_size,
+		uint32_t row_count,
+		uint32_t line_offset,
+		uint32_t line_size)
 	{
-		IReedSolomonCoder* pCoder = std::get<0>(coder_info);
-		uint32_t ecc_offset = std::get<1>(coder_info);
-
-		uint8_t* code_buff = std::get<0>(buffer_info);
-		uint32_t line_size = std::get<1>(buffer_info);
-		uint32_t begin_line = std::get<2>(buffer_info);
-		uint32_t end_line = std::get<3>(buffer_info);
-
-		ECC_CALLBACK_FUNC func = std::get<0>(callback_info);
-		uint64_t read_offset = std::get<1>(callback_info);
-		uint64_t total_length = std::get<2>(callback_info);
-
-		for (uint32_t i = begin_line; i != end_line; i++) {
-			uint8_t* pData = &code_buff[i*line_size];
-			uint8_t* pEcc = &code_buff[i*line_size + ecc_offset];
-			pCoder->EncodeT(pData, pEcc);
-			//uint32_t coder_result=pCoder->DecodeT(pData,pEcc);
-
-			if (func != nullptr) {
-				uint32_t result = (*func)(read_offset + i*ecc_offset, ecc_offset, total_length, pCoder->ECC_NOERROR);
-				if (result == CODER_BREAK) {
-					thread_exitcode.set_value(CODER_BREAK);
-					return;
+		//the rows wholly inside the file in one go, the reader may have all of them in flight
+		uint32_t full_rows = 0;
+		while (full_rows<row_count && full_rows*row_size + line_offset + line_size <= read_real_length) {
+			full_rows++;
+		}
+		if (full_rows>0 && !reader.ReadRows(read_offset + line_offset, line_size, row_size, full_rows, buff)) {
+			return false;
+		}
+		for (uint32_t j = full_rows; j<row_count; j++) {
+			uint32_t row_offset = j*row_size + line_offset;
+			uint32_t real_length = 0;
+			if (row_offset<read_real_length) {
+				real_length = std::min(line_size, read_real_length - row_offset);
+			}
+			if (real_length>0 && !reader.Read(read_offset + row_offset, real_length, &buff[j*line_size])) {
+				return false;
+			}
+			memset(&buff[j*line_size + real_length], 0, line_size - real_length);
+		}
+		return true;
+	}
+
+	//the reverse of ReadLines, the zero padding past the end of file is dropped
+	static bool WriteLines(
+		IFileWriter& writer,
+		const uint8_t* buff,
+		uint64_t write_offset,
+		uint32_t write_real_length,
+		uint32_t row_size,
+		uint32_t row_count,
+		uint32_t line_offset,
+		uint32_t line_size)
+	{
+		for (uint32_t j = 0; j<row_count; j++) {
+			uint32_t row_offset = j*row_size + line_offset;
+			if (row_offset >= write_real_length) {
+				break;
+			}
+			uint32_t real_length = std::min(line_size, write_real_length - row_offset);
+			if (!writer.WriteAt(write_offset + row_offset, &buff[j*line_size], real_length)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	//sizes shared by every stripe of one ECC_PARAM
+	struct STRIPE_LAYOUT {
+		uint32_t ui32ChunkSize;
+		uint32_t ui32DataCount;			//data rows of a stripe
+		uint32_t ui32EccSize;			//parity bytes of a line
+		uint32_t ui32LineLength;		//data bytes of a line, as reported to the callback
+		uint32_t ui32CoderChunkLength;	//codewords of a chunk
+		uint32_t ui32CoderDataCount;	//data codewords of a line
+		uint32_t ui32PassLines;			//lines of a stripe queued at once
+		uint32_t ui32RoundLines;		//lines coded in one round, from one or several stripes
+		uint64_t ui64StripeLength;		//file bytes of a full stripe
+	};
+
+	//a stripe, or a pass over part of its lines, coded in one round together with others
+	struct LINE_SEGMENT {
+		uint8_t*	pData;			//chunk i of data row j at pData[j*ui32LineSize + i*chunk_size], nullptr for a hole
+		uint32_t	ui32LineSize;
+		uint8_t*	pEcc;			//parity of line i at pEcc[i*ecc_size]
+		uint8_t*	pResult;		//decoding result of line i, nullptr when encoding
+		uint32_t	ui32FirstLine;	//index of line 0 among the lines of the round
+		uint64_t	ui64Offset;		//callback offset of line 0
+		uint64_t	ui64Length;		//callback total_length
+	};
+
+	static const LINE_SEGMENT* FindSegment(const LINE_SEGMENT* segments, uint32_t segment_count, uint32_t line) {
+		//the last segment starting at or before line
+		return std::upper_bound(segments, segments + segment_count, line,
+			[](uint32_t l, const LINE_SEGMENT& s) { return l < s.ui32FirstLine; }) - 1;
+	}
+
+	//chunk k of every data row is zero, the parity is then the cached one of a zero line
+	static bool IsZeroLine(const uint8_t* pData, const STRIPE_LAYOUT& layout, uint32_t line_size) {
+		for (uint32_t j = 0; j<layout.ui32DataCount; j++, pData += line_size) {
+			uint8_t any = 0;
+			for (uint32_t i = 0; i<layout.ui32ChunkSize; i++) {
+				any |= pData[i];
+			}
+			if (any != 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static uint32_t ecc_encode(
+		std::tuple<const IReedSolomonCoder*, const STRIPE_LAYOUT*, const uint8_t*> coder_info,
+		std::tuple<const LINE_SEGMENT*, uint32_t> round_info,
+		std::tuple<CWorkStealingScheduler*, uint32_t> schedule_info,
+		CProgressReporter* pReporter)
+	{
+		const IReedSolomonCoder* pCoder = std::get<0>(coder_info);
+		const STRIPE_LAYOUT& layout = *std::get<1>(coder_info);
+		const uint8_t* pZeroEcc = std::get<2>(coder_info);
+
+		const LINE_SEGMENT* segments = std::get<0>(round_info);
+		uint32_t segment_count = std::get<1>(round_info);
+
+		CWorkStealingScheduler* pScheduler = std::get<0>(schedule_info);
+		uint32_t worker = std::get<1>(schedule_info);
+
+		uint32_t begin_line, end_line;
+		while (pScheduler->Next(worker, begin_line, end_line)) {
+			for (uint32_t i = begin_line; i != end_line; i++) {
+				//line k of a segment is chunk k of every row in it
+				const LINE_SEGMENT* seg = FindSegment(segments, segment_count, i);
+				uint32_t k = i - seg->ui32FirstLine;
+				uint8_t* pEcc = &seg->pEcc[k*layout.ui32EccSize];
+				if (seg->pData == nullptr || IsZeroLine(&seg->pData[k*layout.ui32ChunkSize], layout, seg->ui32LineSize)) {
+					memcpy(pEcc, pZeroEcc, layout.ui32EccSize);
+				}
+				else {
+					uint8_t* pData = &seg->pData[k*layout.ui32ChunkSize];
+					pCoder->EncodeS(pData, layout.ui32CoderDataCount, layout.ui32CoderChunkLength, seg->ui32LineSize, pEcc);
+				}
+
+				if (pReporter != nullptr) {
+					pReporter->Add(worker, layout.ui32LineLength);
+					if (pReporter->Stopped()) {
+						return CODER_BREAK;
+					}
 				}
 			}
 		}
-		thread_exitcode.set_value(CODER_CONTIONUE);
+		return CODER_CONTIONUE;
 
 		//printf("--end %d\n",
 		//    ErrorCorrectingCodes::CPoly<65535,ErrorCorrectingCodes::CFNT<4>>::GetMemPool()->m_dlSegment.m_pDummy);
 	}
 
 
-	static void ecc_decode(
-		std::tuple<IReedSolomonCoder*, uint32_t> coder_info,
-		std::tuple<uint8_t*, uint32_t, uint32_t, uint32_t> buffer_info,
-		std::tuple<ECC_CALLBACK_FUNC, uint64_t, uint64_t> callback_info,
-		std::promise<uint32_t>&& thread_exitcode)
+	//decoding, phase one: the syndrome of every line, the same cheap work for each of them
+	//clean lines are done here, their result stays ECC_NOERROR, the others are added to repair_lines for ecc_repair
+	static uint32_t ecc_check(
+		std::tuple<const IReedSolomonCoder*, const STRIPE_LAYOUT*, const uint8_t*> coder_info,
+		std::tuple<const LINE_SEGMENT*, uint32_t> round_info,
+		std::tuple<CWorkStealingScheduler*, uint32_t> schedule_info,
+		std::tuple<uint32_t*, std::atomic<uint32_t>*> repair_info,
+		CProgressReporter* pReporter)
 	{
-		IReedSolomonCoder* pCoder = std::get<0>(coder_info);
-		uint32_t ecc_offset = std::get<1>(coder_info);
-
-		uint8_t* code_buff = std::get<0>(buffer_info);
-		uint32_t line_size = std::get<1>(buffer_info);
-		uint32_t begin_line = std::get<2>(buffer_info);
-		uint32_t end_line = std::get<3>(buffer_info);
-
-		ECC_CALLBACK_FUNC func = std::get<0>(callback_info);
-		uint64_t read_offset = std::get<1>(callback_info);
-		uint64_t total_length = std::get<2>(callback_info);
-
-		for (uint32_t i = begin_line; i != end_line; i++) {
-			uint8_t* pData = &code_buff[i*line_size];
-			uint8_t* pEcc = &code_buff[i*line_size + ecc_offset];
-			uint32_t coder_result = pCoder->DecodeT(pData, pEcc);
-
-			if (func != nullptr) {
-				uint32_t result = (*func)(read_offset + i*ecc_offset, ecc_offset, total_length, coder_result);
-				if (result == CODER_BREAK) {
-					thread_exitcode.set_value(CODER_BREAK);
-					return;
+		const IReedSolomonCoder* pCoder = std::get<0>(coder_info);
+		const STRIPE_LAYOUT& layout = *std::get<1>(coder_info);
+
+		const LINE_SEGMENT* segments = std::get<0>(round_info);
+		uint32_t segment_count = std::get<1>(round_info);
+
+		CWorkStealingScheduler* pScheduler = std::get<0>(schedule_info);
+		uint32_t worker = std::get<1>(schedule_info);
+
+		uint32_t* repair_lines = std::get<0>(repair_info);
+		std::atomic<uint32_t>& repair_count = *std::get<1>(repair_info);
+
+		uint32_t begin_line, end_line;
+		while (pScheduler->Next(worker, begin_line, end_line)) {
+			for (uint32_t i = begin_line; i != end_line; i++) {
+				const LINE_SEGMENT* seg = FindSegment(segments, segment_count, i);
+				uint32_t k = i - seg->ui32FirstLine;
+				const uint8_t* pData = &seg->pData[k*layout.ui32ChunkSize];
+				const uint8_t* pEcc = &seg->pEcc[k*layout.ui32EccSize];
+				if (!pCoder->CheckS(pData, layout.ui32CoderDataCount, layout.ui32CoderChunkLength, seg->ui32LineSize, pEcc)) {
+					repair_lines[repair_count.fetch_add(1, std::memory_order_relaxed)] = i;
+					continue;
+				}
+
+				if (pReporter != nullptr) {
+					pReporter->Add(worker, layout.ui32LineLength);
+					if (pReporter->Stopped()) {
+						return CODER_BREAK;
+					}
+				}
+			}
+		}
+		return CODER_CONTIONUE;
+	}
+
+	//decoding, phase two: the lines ecc_check found damaged, one at a time since each is expensive
+	static uint32_t ecc_repair(
+		std::tuple<const IReedSolomonCoder*, const STRIPE_LAYOUT*, const uint8_t*> coder_info,
+		std::tuple<const LINE_SEGMENT*, uint32_t> round_info,
+		std::tuple<CWorkStealingScheduler*, uint32_t> schedule_info,
+		const uint32_t* repair_lines,
+		CProgressReporter* pReporter)
+	{
+		const IReedSolomonCoder* pCoder = std::get<0>(coder_info);
+		const STRIPE_LAYOUT& layout = *std::get<1>(coder_info);
+
+		const LINE_SEGMENT* segments = std::get<0>(round_info);
+		uint32_t segment_count = std::get<1>(round_info);
+
+		CWorkStealingScheduler* pScheduler = std::get<0>(schedule_info);
+		uint32_t worker = std::get<1>(schedule_info);
+
+		uint32_t begin_repair, end_repair;
+		while (pScheduler->Next(worker, begin_repair, end_repair)) {
+			for (uint32_t r = begin_repair; r != end_repair; r++) {
+				//repairs land straight in the segment
+				uint32_t i = repair_lines[r];
+				const LINE_SEGMENT* seg = FindSegment(segments, segment_count, i);
+				uint32_t k = i - seg->ui32FirstLine;
+				uint8_t* pData = &seg->pData[k*layout.ui32ChunkSize];
+				const uint8_t* pEcc = &seg->pEcc[k*layout.ui32EccSize];
+				uint32_t coder_result = pCoder->DecodeS(pData, layout.ui32CoderDataCount, layout.ui32CoderChunkLength, seg->ui32LineSize, pEcc);
+				seg->pResult[k] = (uint8_t)coder_result;
+
+				if (pReporter != nullptr) {
+					//damaged lines are rare, they get a callback of their own
+					pReporter->Push(seg->ui64Offset + (uint64_t)k*layout.ui32LineLength, layout.ui32LineLength, seg->ui64Length, coder_result);
+					if (pReporter->Stopped()) {
+						return CODER_BREAK;
+					}
+				}
+			}
+		}
+		return CODER_CONTIONUE;
+	}
+
+	//one file of a batch, kept open while any of its segments waits in the round
+	struct FILE_TASK {
+		std::unique_ptr<IFileReader> raw_reader;
+		std::unique_ptr<IFileReader> ecc_reader;	//decoding only
+		std::unique_ptr<IFileWriter> writer;		//the ecc file when encoding, the fix file when decoding
+		ECC_PARAM ecc_param;
+		uint64_t ui64FileLength;
+		uint64_t ui64EccOffset;		//parity of the current stripe in the ecc file
+		std::vector<BYTE_RANGE> vRanges;	//coding only the lines that hold these bytes, empty for all
+		bool bWriteAt;				//parity or fix data goes to its own offset, it is not appended
+		bool bStreaming;			//encoding a pipe, the ecc file gets a trailer, see CreateEccFiles
+		bool bQueued;				//every segment is in a round
+		bool bFailed;
+		uint32_t ui32Result;		//decoding only, the worst result of its lines so far
+	};
+
+	//where the lines of a segment belong in their file
+	struct SEGMENT_FILE {
+		FILE_TASK*	pTask;
+		uint64_t	ui64StripeOffset;
+		uint64_t	ui64EccOffset;		//parity of the segment in the ecc file
+		uint32_t	ui32StripeLength;	//real bytes of the stripe
+		uint32_t	ui32RowSize;		//distance of two data rows in the file
+		uint32_t	ui32LineOffset;		//first line of the segment, times chunk_size
+		uint32_t	ui32LineCount;
+		bool		bMapped;			//data or parity points into a reader's mapping
+		bool		bInPlace;			//coded in the writer's own memory, there is nothing to write
+	};
+
+	//lines from several stripes, possibly of several files, coded in one go on the worker pool
+	//a segment holding a mapping is the last one of its file in the round, see RoundFits
+	struct CODER_ROUND {
+		ECC_PARAM param;
+		STRIPE_LAYOUT layout;
+		const IReedSolomonCoder* pCoder;
+		CLargeBuffer read_buff;	//[ui32RoundLines][ui32DataCount][ui32ChunkSize], allocated on first use
+		CLargeBuffer ecc_buff;	//[ui32RoundLines][ui32EccSize], same layout as in the ecc file
+		std::unique_ptr<uint8_t[]> line_result;	//[ui32RoundLines]
+		std::unique_ptr<uint32_t[]> repair_lines;	//[ui32RoundLines], lines with a nonzero syndrome, decoding only
+		std::unique_ptr<uint8_t[]> zero_ecc;	//[ui32EccSize], parity of an all-zero line, encoding only
+		uint32_t line_count;
+		std::vector<LINE_SEGMENT> vSegment;
+		std::vector<SEGMENT_FILE> vSegmentFile;
+		std::vector<std::unique_ptr<FILE_TASK>> vTask;
+	};
+
+	STRIPE_LAYOUT GetStripeLayout(const ECC_PARAM& ecc_param) {
+		STRIPE_LAYOUT layout;
+		uint32_t ecc_codeword_size = GetCodeWordSize(ecc_param);
+		layout.ui32ChunkSize = ecc_param.ui32ChunkSize;
+		layout.ui32DataCount = ecc_param.ui32ChunkCount - ecc_param.ui32EccCount;
+		layout.ui32EccSize = ecc_param.ui32EccCount*ecc_param.ui32ChunkSize - ecc_codeword_size;
+		layout.ui32LineLength = layout.ui32DataCount*layout.ui32ChunkSize + ecc_codeword_size;
+		//a line is chunk i of each of the data rows, the coder reads it in place
+		layout.ui32CoderChunkLength = layout.ui32ChunkSize / ecc_codeword_size;
+		layout.ui32CoderDataCount = layout.ui32DataCount*layout.ui32CoderChunkLength;
+		layout.ui32PassLines = GetPassLines(ecc_param);
+		layout.ui32RoundLines = GetRoundLines(ecc_param);
+		layout.ui64StripeLength = (uint64_t)ecc_param.ui32Intertwine*layout.ui32DataCount*layout.ui32ChunkSize;
+		return layout;
+	}
+
+	void ResetRound(CODER_ROUND& round, const ECC_PARAM& ecc_param) {
+		round.param = ecc_param;
+		round.layout = GetStripeLayout(ecc_param);
+		round.pCoder = GetEccCoder(ecc_param);
+		round.read_buff.reset();
+		round.ecc_buff.reset();
+		round.line_result.reset();
+		round.repair_lines.reset();
+		round.zero_ecc.reset();
+		round.line_count = 0;
+	}
+
+	//whether lines [pass_begin,pass_begin+pass_count) of pTask can join the round
+	//several stripes of a file may share a round as long as they were copied into it,
+	//a mapping is only valid until the file's next Map or Read
+	static bool RoundFits(const CODER_ROUND& round, const FILE_TASK* pTask, uint32_t pass_count) {
+		if (round.line_count + pass_count > round.layout.ui32RoundLines) {
+			return false;
+		}
+		//a full pass keeps all cores busy on its own, short ones fill up the round before them
+		if (pass_count == round.layout.ui32PassLines && round.line_count >= round.layout.ui32PassLines) {
+			return false;
+		}
+		return round.vSegmentFile.empty() || round.vSegmentFile.back().pTask != pTask || !round.vSegmentFile.back().bMapped;
+	}
+
+	//read lines [pass_begin,pass_begin+pass_count) of the stripe at read_offset into the round,
+	//with their parity too when decoding
+	bool QueueSegment(
+		CODER_ROUND& round,
+		FILE_TASK* pTask,
+		uint64_t read_offset,
+		uint32_t read_real_length,
+		uint32_t read_intertwinet,
+		uint32_t pass_begin,
+		uint32_t pass_count)
+	{
+		const STRIPE_LAYOUT& layout = round.layout;
+		bool bDecode = pTask->ecc_reader != nullptr;
+
+		uint32_t buff_line_size = read_intertwinet*layout.ui32ChunkSize;
+		uint32_t pass_line_size = pass_count*layout.ui32ChunkSize;
+
+		LINE_SEGMENT seg;
+		seg.ui32LineSize = pass_line_size;
+		seg.ui32FirstLine = round.line_count;
+		seg.ui64Offset = read_offset + (uint64_t)pass_begin*layout.ui32LineLength;
+		seg.ui64Length = pTask->ui64FileLength;
+
+		//a hole of a sparse file is not read at all, its lines get the zero parity
+		bool bHole = false;
+		if (!bDecode) {
+			if (!round.zero_ecc) {
+				std::unique_ptr<uint8_t[]> zero_line(new uint8_t[layout.ui32DataCount*layout.ui32ChunkSize]());
+				round.zero_ecc.reset(new uint8_t[layout.ui32EccSize]());
+				round.pCoder->EncodeS(zero_line.get(), layout.ui32CoderDataCount, layout.ui32CoderChunkLength, layout.ui32ChunkSize, round.zero_ecc.get());
+			}
+			bHole = pTask->raw_reader->IsHole(read_offset, read_real_length);
+		}
+
+		//a full stripe comes straight from the reader's mapping if it has one
+		seg.pData = nullptr;
+		bool bMapped = false;
+		if (!bHole && pass_count == read_intertwinet && read_real_length == buff_line_size*layout.ui32DataCount) {
+			seg.pData = pTask->raw_reader->Map(read_offset, read_real_length);
+			bMapped = seg.pData != nullptr;
+		}
+		if (!bHole && seg.pData == nullptr) {
+			if (!round.read_buff) {
+				if (!round.read_buff.reset((size_t)layout.ui32RoundLines*layout.ui32DataCount*layout.ui32ChunkSize)) {
+					return false;
+				}
+				BindRoundBuffer(round.read_buff.get(), layout, layout.ui32DataCount, layout.ui32ChunkSize);
+			}
+			seg.pData = &round.read_buff[(uint64_t)round.line_count*layout.ui32DataCount*layout.ui32ChunkSize];
+			bool bRead = false;
+			if (pass_count == read_intertwinet) {
+				bRead = ReadStripe(*pTask->raw_reader, seg.pData, read_offset, read_real_length, buff_line_size*layout.ui32DataCount);
+			}
+			else {
+				bRead = ReadLines(*pTask->raw_reader, seg.pData, read_offset, read_real_length, buff_line_size, layout.ui32DataCount, pass_begin*layout.ui32ChunkSize, pass_line_size);
+			}
+			if (!bRead) {
+				return false;
+			}
+		}
+
+		if (!round.ecc_buff) {
+			//zeroed, the 8 bits coder may leave the last word of a line unused
+			if (!round.ecc_buff.reset((size_t)layout.ui32RoundLines*layout.ui32EccSize)) {
+				return false;
+			}
+			BindRoundBuffer(round.ecc_buff.get(), layout, 1, layout.ui32EccSize);
+			round.line_result.reset(new uint8_t[layout.ui32RoundLines]);
+			round.repair_lines.reset(new uint32_t[layout.ui32RoundLines]);
+		}
+		seg.pEcc = &round.ecc_buff[(uint64_t)round.line_count*layout.ui32EccSize];
+		seg.pResult = nullptr;
+		bool bInPlace = false;
+		if (!bDecode && pTask->bWriteAt) {
+			//the parity goes straight to the writer's memory if it has some
+			uint8_t* mapped = pTask->writer->Map(pTask->ui64EccOffset + (uint64_t)pass_begin*layout.ui32EccSize, pass_count*layout.ui32EccSize);
+			if (mapped != nullptr) {
+				seg.pEcc = mapped;
+				bInPlace = true;
+			}
+		}
+		if (bDecode && bMapped && pTask->bWriteAt) {
+			//data mapped from the memory it is written back to is repaired right there
+			bInPlace = pTask->writer->Map(read_offset, read_real_length) == seg.pData;
+		}
+		if (bDecode) {
+			//the parity of a stripe is contiguous in the ecc file
+			uint64_t pass_ecc_offset = pTask->ui64EccOffset + (uint64_t)pass_begin*layout.ui32EccSize;
+			uint32_t ecc_real_length = pass_count*layout.ui32EccSize;
+			uint8_t* mapped = pTask->ecc_reader->Map(pass_ecc_offset, ecc_real_length);
+			if (mapped != nullptr) {
+				seg.pEcc = mapped;
+				bMapped = true;
+			}
+			else if (!pTask->ecc_reader->Read(pass_ecc_offset, ecc_real_length, seg.pEcc)) {
+				return false;
+			}
+			seg.pResult = &round.line_result[round.line_count];
+			memset(seg.pResult, IReedSolomonCoder::ECC_NOERROR, pass_count);
+		}
+
+		SEGMENT_FILE seg_file;
+		seg_file.pTask = pTask;
+		seg_file.ui64StripeOffset = read_offset;
+		seg_file.ui64EccOffset = pTask->ui64EccOffset + (uint64_t)pass_begin*layout.ui32EccSize;
+		seg_file.ui32StripeLength = read_real_length;
+		seg_file.ui32RowSize = buff_line_size;
+		seg_file.ui32LineOffset = pass_begin*layout.ui32ChunkSize;
+		seg_file.ui32LineCount = pass_count;
+		seg_file.bMapped = bMapped;
+		seg_file.bInPlace = bInPlace;
+
+		round.vSegment.push_back(seg);
+		round.vSegmentFile.push_back(seg_file);
+		round.line_count += pass_count;
+		return true;
+	}
+
+	//coder(scheduler, worker) on the pool for the items [0,item_count), handed out item_batch at a time,
+	//idle threads steal from busy ones
+	//return true if a worker was asked to stop
+	template<typename _CoderFunc>
+	bool RunCoder(uint32_t item_count, uint32_t item_batch, _CoderFunc coder) {
+		CWorkerPool& pool = *m_pPool;
+		uint32_t worker_count = std::min(pool.GetThreadCount(), item_count);
+		CWorkStealingScheduler scheduler(worker_count, item_batch);
+		scheduler.Reset(0, item_count);
+		std::vector<uint32_t> vExitCode(worker_count, CODER_CONTIONUE);
+		CWorkerPool::JOB_FUNC job = [&](uint32_t worker) {
+			vExitCode[worker] = coder(&scheduler, worker);
+		};
+		pool.Run(worker_count, job);
+		return std::find(vExitCode.begin(), vExitCode.end(), (uint32_t)CODER_BREAK) != vExitCode.end();
+	}
+
+	//code the round, write out what it produced and close the files that are done
+	//return false if a write failed, bBreak is set when a callback asked to stop
+	bool FlushRound(CODER_ROUND& round, bool& bBreak) {
+		if (round.line_count>0) {
+			bool bDecode = round.vSegment[0].pResult != nullptr;
+			auto coder_info = std::make_tuple(round.pCoder, (const STRIPE_LAYOUT*)&round.layout, (const uint8_t*)round.zero_ecc.get());
+			auto round_info = std::make_tuple((const LINE_SEGMENT*)round.vSegment.data(), (uint32_t)round.vSegment.size());
+
+			if (!bDecode) {
+				bBreak |= RunCoder(round.line_count, CWorkStealingScheduler::DEFAULT_BATCH_SIZE,
+					[&](CWorkStealingScheduler* pScheduler, uint32_t worker) {
+					return ecc_encode(coder_info, round_info, std::make_tuple(pScheduler, worker), m_pReporter.get());
+				});
+			}
+			else {
+				//syndromes first, all cores then work on the damaged lines alone
+				std::atomic<uint32_t> repair_count(0);
+				uint32_t* repair_lines = round.repair_lines.get();
+				bBreak |= RunCoder(round.line_count, CWorkStealingScheduler::DEFAULT_BATCH_SIZE,
+					[&](CWorkStealingScheduler* pScheduler, uint32_t worker) {
+					return ecc_check(coder_info, round_info, std::make_tuple(pScheduler, worker), std::make_tuple(repair_lines, &repair_count), m_pReporter.get());
+				});
+				uint32_t repair_line_count = repair_count.load();
+				if (!bBreak && repair_line_count>0) {
+					//in file order, the workers found them in any order
+					std::sort(repair_lines, repair_lines + repair_line_count);
+					bBreak |= RunCoder(repair_line_count, REPAIR_BATCH_SIZE,
+						[&](CWorkStealingScheduler* pScheduler, uint32_t worker) {
+						return ecc_repair(coder_info, round_info, std::make_tuple(pScheduler, worker), repair_lines, m_pReporter.get());
+					});
 				}
 			}
+			//failures of this round reach the callback before anything is written
+			if (m_pReporter) {
+				m_pReporter->Report();
+				bBreak |= m_pReporter->Stopped();
+			}
+
+			//segments of one file are in order across rounds, so the files are written in order
+			for (size_t s = 0; s<round.vSegment.size(); s++) {
+				const LINE_SEGMENT& seg = round.vSegment[s];
+				const SEGMENT_FILE& seg_file = round.vSegmentFile[s];
+				FILE_TASK* pTask = seg_file.pTask;
+				if (pTask->bFailed) {
+					continue;
+				}
+				if (bDecode) {
+					for (uint32_t k = 0; k<seg_file.ui32LineCount; k++) {
+						pTask->ui32Result = std::max<uint32_t>(pTask->ui32Result, seg.pResult[k]);
+					}
+				}
+				bool bWrite = false;
+				if (seg_file.bInPlace) {
+					bWrite = true;
+				}
+				else if (!bDecode && !pTask->bWriteAt) {
+					bWrite = pTask->writer->Write(seg.pEcc, seg_file.ui32LineCount*round.layout.ui32EccSize);
+				}
+				else if (!bDecode) {
+					bWrite = pTask->writer->WriteAt(seg_file.ui64EccOffset, seg.pEcc, seg_file.ui32LineCount*round.layout.ui32EccSize);
+				}
+				else if (!pTask->bWriteAt) {
+					bWrite = pTask->writer->Write(seg.pData, seg_file.ui32StripeLength);
+				}
+				else {
+					bWrite = WriteLines(*pTask->writer, seg.pData, seg_file.ui64StripeOffset, seg_file.ui32StripeLength,
+						seg_file.ui32RowSize, round.layout.ui32DataCount, seg_file.ui32LineOffset, seg.ui32LineSize);
+				}
+				if (!bWrite) {
+					pTask->bFailed = true;
+				}
+			}
+		}
+		round.line_count = 0;
+		round.vSegment.clear();
+		round.vSegmentFile.clear();
+
+		bool bError = false;
+		for (size_t t = 0; t<round.vTask.size(); ) {
+			FILE_TASK* pTask = round.vTask[t].get();
+			if (!pTask->bQueued && !pTask->bFailed) {
+				t++;
+				continue;
+			}
+			if (pTask->bStreaming && !pTask->bFailed && !bBreak) {
+				if (!WriteEccHeader(*pTask->writer, pTask->ecc_param, pTask->ui64FileLength)) {
+					pTask->bFailed = true;
+				}
+			}
+			if (!pTask->writer->Close()) {
+				pTask->bFailed = true;
+			}
+			if (pTask->bFailed) {
+				bError = true;
+			}
+			round.vTask.erase(round.vTask.begin() + t);
+		}
+		return !bError;
+	}
+
+	//queue every stripe of the file, the round is flushed whenever the next part does not fit
+	static uint64_t GetRangeEnd(const BYTE_RANGE& range) {
+		return range.second>UINT64_MAX - range.first ? UINT64_MAX : range.first + range.second;
+	}
+
+	//first stripe at or after read_offset that holds a byte of the task's ranges, read_offset without ranges
+	static uint64_t NextStripe(const FILE_TASK* pTask, const STRIPE_LAYOUT& layout, uint64_t read_offset) {
+		if (pTask->vRanges.empty()) {
+			return read_offset;
 		}
-		thread_exitcode.set_value(CODER_CONTIONUE);
+		uint64_t next = UINT64_MAX;
+		for (const BYTE_RANGE& range : pTask->vRanges) {
+			if (range.second == 0 || GetRangeEnd(range) <= read_offset) {
+				continue;
+			}
+			uint64_t begin = std::max(range.first, read_offset);
+			next = std::min(next, begin - begin%layout.ui64StripeLength);
+		}
+		return next;
 	}
+
+	//line runs [first,second) of the stripe at read_offset to code, all of its lines without ranges
+	//byte o of a stripe is in chunk c = o/chunk_size, which belongs to line c%read_intertwinet
+	static std::vector<std::pair<uint32_t, uint32_t>> GetLineRuns(const FILE_TASK* pTask, const STRIPE_LAYOUT& layout,
+		uint64_t read_offset, uint32_t read_real_length, uint32_t read_intertwinet)
+	{
+		std::vector<std::pair<uint32_t, uint32_t>> runs;
+		if (pTask->vRanges.empty()) {
+			runs.push_back(std::make_pair(0u, read_intertwinet));
+			return runs;
+		}
+		std::vector<uint8_t> marks(read_intertwinet, 0);
+		for (const BYTE_RANGE& range : pTask->vRanges) {
+			uint64_t begin = std::max(range.first, read_offset);
+			uint64_t end = std::min(GetRangeEnd(range), read_offset + read_real_length);
+			if (begin >= end) {
+				continue;
+			}
+			uint64_t first_chunk = (begin - read_offset) / layout.ui32ChunkSize;
+			uint64_t last_chunk = (end - read_offset - 1) / layout.ui32ChunkSize;
+			if (last_chunk - first_chunk + 1 >= read_intertwinet) {
+				memset(marks.data(), 1, read_intertwinet);
+				continue;
+			}
+			for (uint64_t c = first_chunk; c <= last_chunk; c++) {
+				marks[c%read_intertwinet] = 1;
+			}
+		}
+		for (uint32_t i = 0; i<read_intertwinet; ) {
+			if (!marks[i]) {
+				i++;
+				continue;
+			}
+			uint32_t first = i;
+			while (i<read_intertwinet && marks[i]) {
+				i++;
+			}
+			runs.push_back(std::make_pair(first, i));
+		}
+		return runs;
+	}
+
+	bool QueueFile(CODER_ROUND& round, FILE_TASK* pTask, bool& bBreak) {
+		const STRIPE_LAYOUT& layout = round.layout;
+		bool bError = false;
+		if (m_pReporter) {
+			m_pReporter->SetTotalLength(pTask->ui64FileLength);
+		}
+		uint64_t full_stripe_ecc_size = (uint64_t)pTask->ecc_param.ui32Intertwine*layout.ui32EccSize;
+		for (uint64_t read_offset = NextStripe(pTask, layout, 0); read_offset<pTask->ui64FileLength && !pTask->bFailed && !bBreak; read_offset = NextStripe(pTask, layout, read_offset + layout.ui64StripeLength)) {
+			//every stripe before this one is full
+			pTask->ui64EccOffset = CReedSolomonCoder8::N + read_offset / layout.ui64StripeLength*full_stripe_ecc_size;
+
+			if (pTask->bStreaming) {
+				//the previous stripe may still sit in the reader's buffer
+				if (!RoundFits(round, pTask, 0)) {
+					bError |= !FlushRound(round, bBreak);
+					if (bBreak) {
+						break;
+					}
+				}
+				//buffers the whole stripe, a short one tells the length
+				pTask->raw_reader->Map(read_offset, (uint32_t)layout.ui64StripeLength);
+				pTask->ui64FileLength = pTask->raw_reader->GetLength();
+				if (read_offset >= pTask->ui64FileLength) {
+					break;
+				}
+			}
+
+			uint32_t read_real_length = (uint32_t)std::min(pTask->ui64FileLength - read_offset, layout.ui64StripeLength);
+			uint32_t read_chunk_count = (read_real_length + layout.ui32ChunkSize - 1) / layout.ui32ChunkSize;
+			uint32_t read_intertwinet = (read_chunk_count + layout.ui32DataCount - 1) / layout.ui32DataCount;
+
+			auto runs = GetLineRuns(pTask, layout, read_offset, read_real_length, read_intertwinet);
+			for (size_t r = 0; r<runs.size() && !pTask->bFailed && !bBreak; r++) {
+				for (uint32_t pass_begin = runs[r].first; pass_begin<runs[r].second; pass_begin += layout.ui32PassLines) {
+					uint32_t pass_count = std::min(layout.ui32PassLines, runs[r].second - pass_begin);
+					if (!RoundFits(round, pTask, pass_count)) {
+						bError |= !FlushRound(round, bBreak);
+						if (bBreak) {
+							break;
+						}
+					}
+					if (!QueueSegment(round, pTask, read_offset, read_real_length, read_intertwinet, pass_begin, pass_count)) {
+						pTask->bFailed = true;
+						break;
+					}
+				}
+			}
+		}
+		pTask->bQueued = true;
+		return !bError;
+	}
+
+	//write the header of a task with its reader and writer open, then queue all of its stripes
+	bool QueueEncodeTask(CODER_ROUND& round, std::unique_ptr<FILE_TASK> pTask, bool& bBreak) {
+		//a pipe only knows its length at the end, the header then says FileIO::UNKNOWN_LENGTH
+		//and a second copy with the real length follows the parity
+		pTask->ecc_param = round.param;
+		pTask->ui64FileLength = pTask->raw_reader->GetLength();
+		pTask->ui64EccOffset = CReedSolomonCoder8::N;
+		pTask->bWriteAt = false;
+		pTask->bStreaming = pTask->ui64FileLength == FileIO::UNKNOWN_LENGTH;
+		pTask->bQueued = false;
+		pTask->bFailed = false;
+
+		if (!WriteEccHeader(*pTask->writer, round.param, pTask->ui64FileLength)) {
+			return false;
+		}
+
+		round.vTask.push_back(std::move(pTask));
+		return QueueFile(round, round.vTask.back().get(), bBreak);
+	}
+
+	//bytes of the ecc file of a file_length bytes file, header included
+	static uint64_t GetEccLength(const ECC_PARAM& ecc_param, uint64_t file_length) {
+		uint32_t data_count = ecc_param.ui32ChunkCount - ecc_param.ui32EccCount;
+		uint64_t ecc_size = ecc_param.ui32EccCount*ecc_param.ui32ChunkSize - GetCodeWordSize(ecc_param);
+		uint64_t stripe_length = (uint64_t)ecc_param.ui32Intertwine*data_count*ecc_param.ui32ChunkSize;
+		uint64_t tail_length = file_length%stripe_length;
+		uint64_t tail_chunk_count = (tail_length + ecc_param.ui32ChunkSize - 1) / ecc_param.ui32ChunkSize;
+		uint64_t tail_intertwinet = (tail_chunk_count + data_count - 1) / data_count;
+		return CReedSolomonCoder8::N + (file_length / stripe_length*ecc_param.ui32Intertwine + tail_intertwinet)*ecc_size;
+	}
+
+	//chunk size and stripe of a 16 bits code, file_length 0 for unknown
+	//a file filling up to a quarter of a line pays more for the padding of the line than for short lines,
+	//checks included: a short line costs more per word than the packed transform of a full one
+	static void FitChunkSize(ECC_PARAM& ecc_param, uint32_t ecc_intertwine_mb, uint64_t file_length) {
+		uint32_t data_count = ecc_param.ui32ChunkCount - ecc_param.ui32EccCount;
+		ecc_param.ui32ChunkSize = 512;
+		if (file_length != 0 && file_length <= (uint64_t)ecc_param.ui32ChunkSize*data_count / 4) {
+			while (ecc_param.ui32ChunkSize>MIN_SHORT_CHUNK_SIZE && file_length <= (uint64_t)(ecc_param.ui32ChunkSize / 2)*data_count*SHORT_FILE_LINES) {
+				ecc_param.ui32ChunkSize /= 2;
+			}
+		}
+		ecc_param.ui32Intertwine = (ecc_intertwine_mb << 20) / (data_count*ecc_param.ui32ChunkSize);
+	}
+
+	//a line costs one chunk of every data row plus its parity
+	static uint64_t GetLineCost(const ECC_PARAM& ecc_param) {
+		uint32_t code_ecc_size = ecc_param.ui32EccCount*ecc_param.ui32ChunkSize - GetCodeWordSize(ecc_param);
+		return (uint64_t)(ecc_param.ui32ChunkCount - ecc_param.ui32EccCount)*ecc_param.ui32ChunkSize + code_ecc_size + 1;
+	}
+
+	//lines of a stripe queued in one pass
+	uint32_t GetPassLines(const ECC_PARAM& ecc_param) {
+		if (m_ui64MemoryBudget == 0) {
+			return ecc_param.ui32Intertwine;
+		}
+		uint64_t pass_lines = m_ui64MemoryBudget / GetLineCost(ecc_param);
+		return (uint32_t)std::max<uint64_t>(1, std::min<uint64_t>(pass_lines, ecc_param.ui32Intertwine));
+	}
+
+	//lines coded in one round, up to MAX_ROUND_STRIPES stripes within the budget but one pass at least,
+	//so a short stripe is coded together with the one before instead of on a few cores
+	uint32_t GetRoundLines(const ECC_PARAM& ecc_param) {
+		uint64_t round_lines = (uint64_t)ecc_param.ui32Intertwine*MAX_ROUND_STRIPES;
+		if (m_ui64MemoryBudget != 0) {
+			round_lines = std::min<uint64_t>(round_lines, m_ui64MemoryBudget / GetLineCost(ecc_param));
+		}
+		return (uint32_t)std::max<uint64_t>(GetPassLines(ecc_param), round_lines);
+	}
+
+	//workers [ui32FirstWorker,ui32FirstWorker+ui32WorkerCount) are pinned to cpus of ui32Node
+	struct NUMA_NODE {
+		uint32_t ui32Node;
+		uint32_t ui32FirstWorker;
+		uint32_t ui32WorkerCount;
+	};
+
+	//spread the workers over the nodes in proportion to their cpus, node by node,
+	//so the even split of CWorkStealingScheduler::Reset gives each node a contiguous share of lines
+	static void PlaceWorkers(uint32_t thread_count, std::vector<uint32_t>& cpus, std::vector<NUMA_NODE>& nodes) {
+		auto topology = Numa::GetTopology();
+		uint32_t total_cpus = 0;
+		for (auto& node : topology) {
+			total_cpus += (uint32_t)node.second.size();
+		}
+		uint32_t counted_cpus = 0;
+		for (auto& node : topology) {
+			NUMA_NODE numa_node;
+			numa_node.ui32Node = node.first;
+			numa_node.ui32FirstWorker = (uint32_t)((uint64_t)thread_count*counted_cpus / total_cpus);
+			counted_cpus += (uint32_t)node.second.size();
+			numa_node.ui32WorkerCount = (uint32_t)((uint64_t)thread_count*counted_cpus / total_cpus) - numa_node.ui32FirstWorker;
+			for (uint32_t i = 0; i<numa_node.ui32WorkerCount; i++) {
+				cpus.push_back(node.second[i%node.second.size()]);
+			}
+			if (numa_node.ui32WorkerCount>0) {
+				nodes.push_back(numa_node);
+			}
+		}
+	}
+
+	//the threads live as long as the file coder, unless a later call asks for another count or placement
+	//a pool given to SetWorkerPool is kept whatever the count
+	void StartWorkerPool(uint32_t thread_count) {
+		if (m_bSharedPool) {
+			return;
+		}
+		thread_count = Tuning::GetThreadCount(thread_count);
+		std::vector<uint32_t> cpus;
+		std::vector<NUMA_NODE> nodes;
+		if (m_bNuma) {
+			PlaceWorkers(thread_count, cpus, nodes);
+		}
+		if (!m_pPool || m_pPool->GetThreadCount() != thread_count || m_vWorkerCpus != cpus) {
+			m_pPool.reset();
+			m_pPool.reset(new CWorkerPool(thread_count, cpus));
+			m_vWorkerCpus = cpus;
+			m_vNumaNodes = nodes;
+		}
+	}
+
+	//a full pass is always the first segment of its round, give each node the part of every row
+	//that holds the lines its workers start on, the pages are placed when the buffer is first touched
+	//rows are ui32PassLines*line_size apart
+	void BindRoundBuffer(uint8_t* pBuff, const STRIPE_LAYOUT& layout, uint32_t row_count, uint32_t line_size) {
+		if (m_vNumaNodes.size()<2) {
+			return;
+		}
+		uint32_t worker_count = m_pPool->GetThreadCount();
+		uint64_t row_size = (uint64_t)layout.ui32PassLines*line_size;
+		for (const NUMA_NODE& node : m_vNumaNodes) {
+			uint64_t begin = (uint64_t)layout.ui32PassLines*node.ui32FirstWorker / worker_count*line_size;
+			uint64_t end = (uint64_t)layout.ui32PassLines*(node.ui32FirstWorker + node.ui32WorkerCount) / worker_count*line_size;
+			for (uint32_t j = 0; j<row_count; j++) {
+				Numa::BindMemory(pBuff + j*row_size + begin, end - begin, node.ui32Node);
+			}
+		}
+	}
+
+	//workers count bytes on their own, a reporter thread calls func with the sums
+	//one reporter per batch call, its last report is made when it is reset
+	void StartReporter(ECC_CALLBACK_FUNC func) {
+		m_pReporter.reset();
+		if (func != nullptr) {
+			m_pReporter.reset(new CProgressReporter(m_pPool->GetThreadCount(),
+				[func](uint64_t offset, uint32_t length, uint64_t total_length, uint32_t result) {
+				return (*func)(offset, length, total_length, result) != CODER_BREAK;
+			}));
+		}
+	}
+
+	uint32_t m_ui32IoBackend;
+	uint32_t m_ui32IoDepth;
+	uint64_t m_ui64MemoryBudget;
+	bool m_bNuma;
+	std::shared_ptr<CWorkerPool> m_pPool;
+	bool m_bSharedPool;
+	std::vector<uint32_t> m_vWorkerCpus;
+	std::vector<NUMA_NODE> m_vNumaNodes;
+	std::unique_ptr<CProgressReporter> m_pReporter;
 public:
-	CEccFileCoder() {
+	CEccFileCoder() :m_ui32IoBackend(FileIO::IO_BACKEND_STREAM), m_ui32IoDepth(Tuning::GetIoDepth(0)), m_ui64MemoryBudget(0), m_bNuma(false), m_bSharedPool(false) {
 	}
 	~CEccFileCoder() {
 	}
 
+	// ecc_codeword_bits 8 or 16, with CODEWORD_BINARY_FIELD for the GF(2^8)/GF(2^16) coder:
+	// its parity costs every data word times every parity word, it suits small parity counts,
+	// the prime field coder's transforms scale to the thousands of parity words of a 16 bits line
+	// file_length, when known, fits a 16 bits code to a small file: its chunks are made smaller,
+	// the lines shorter than the code, which costs time in proportion to the file instead of to full lines
+	// the file is coded the same way with a param made for another length, only slower or with more parity
 	static bool CreateEccParam(
 		ECC_PARAM& ecc_param,
 		uint32_t ecc_size_percent = 3,
 		uint32_t ecc_codeword_bits = 16,
-		uint32_t ecc_intertwine_mb = 32)
+		uint32_t ecc_intertwine_mb = 0/* 0 for the tuned size */,
+		uint64_t file_length = 0/* 0 for unknown */)
 	{
 		if (!(ecc_size_percent > 0 && ecc_size_percent <= 100))
 			return false;
 		//if (!(ecc_codeword_bits==8 || ecc_codeword_bits==16))
 		//	return false;
+		ecc_intertwine_mb = Tuning::GetIntertwineMB(ecc_intertwine_mb);
 		if (!(ecc_intertwine_mb > 0 && ecc_intertwine_mb < 4096))
 			return false;
 
+		uint32_t field = ecc_codeword_bits&CODEWORD_BINARY_FIELD;
+		ecc_codeword_bits &= ~CODEWORD_BINARY_FIELD;
+
 		if (ecc_codeword_bits == 8) {
-			ecc_param.ui32CodeWordBits = 8;
+			ecc_param.ui32CodeWordBits = 8 | field;
 			ecc_param.ui32ChunkSize = 1;
 			ecc_param.ui32ChunkCount = 256;
 			ecc_param.ui32EccCount = ecc_param.ui32ChunkCount*ecc_size_percent / (100 + ecc_size_percent);
@@ -212,293 +1167,509 @@ public:
 			return true;
 		}
 		if (ecc_codeword_bits == 16) {
-			ecc_param.ui32CodeWordBits = 16;
-			ecc_param.ui32ChunkSize = 512;
+			ecc_param.ui32CodeWordBits = 16 | field;
 			ecc_param.ui32ChunkCount = 256;
 			ecc_param.ui32EccCount = ecc_param.ui32ChunkCount*ecc_size_percent / (100 + ecc_size_percent);
-			ecc_param.ui32Intertwine = (ecc_intertwine_mb << 20) / ((ecc_param.ui32ChunkCount - ecc_param.ui32EccCount)*ecc_param.ui32ChunkSize);
+			FitChunkSize(ecc_param, ecc_intertwine_mb, file_length);
 			return true;
 		}
 		return false;
 	}
 
+	// the ECC_PARAM CreateEccParam gives a file_length bytes file with the percent, codeword and stripe size of ecc_param
+	static ECC_PARAM RefitEccParam(const ECC_PARAM& ecc_param, uint64_t file_length) {
+		if ((ecc_param.ui32CodeWordBits&CODEWORD_BITS_MASK) != 16) {
+			return ecc_param;
+		}
+		//a stripe falls short of the size asked for by less than a line, less than 1MB
+		uint64_t stripe_length = (uint64_t)ecc_param.ui32Intertwine*(ecc_param.ui32ChunkCount - ecc_param.ui32EccCount)*ecc_param.ui32ChunkSize;
+		ECC_PARAM refit = ecc_param;
+		FitChunkSize(refit, (uint32_t)((stripe_length + (1 << 20) - 1) >> 20), file_length);
+		return refit;
+	}
+
+	// FileIO::IO_BACKEND_STREAM, IO_BACKEND_MMAP or IO_BACKEND_URING
+	// mmap only changes the input side, uring also writes ecc and fix files with O_DIRECT
+	// io_depth is the number of requests the uring backend keeps in flight, 0 for the tuned depth
+	void SetIoBackend(uint32_t backend, uint32_t io_depth = 0) {
+		m_ui32IoBackend = backend;
+		m_ui32IoDepth = Tuning::GetIoDepth(io_depth);
+	}
+
+	// cap the stripe buffers at about budget bytes, 0 for up to MAX_ROUND_STRIPES whole stripes at once
+	// a stripe larger than that is coded in subsets of lines, the ecc format does not change
+	// the fix file is then written out of order, always through the stream backend
+	void SetMemoryBudget(uint64_t budget) {
+		m_ui64MemoryBudget = budget;
+	}
+
+	// pin the workers node by node and place the stripe buffers on the nodes of the workers
+	// that code their lines, the polynomial pools of a worker then stay on its node too
+	// only on linux, elsewhere the threads are left to the system
+	void SetNumaAware(bool numa) {
+		m_bNuma = numa;
+	}
+
+	// code on a pool shared with other file coders instead of threads of its own, nullptr to go back
+	// rounds of the coders sharing it take turns, see CWorkerPool::Run, the thread_count of the calls is ignored
+	// the pool's workers are not placed by SetNumaAware
+	void SetWorkerPool(const std::shared_ptr<CWorkerPool>& pool) {
+		m_pPool = pool;
+		m_bSharedPool = pool != nullptr;
+		m_vWorkerCpus.clear();
+		m_vNumaNodes.clear();
+	}
+
+	// bytes of the ecc file of a file_length bytes file
+	static uint64_t GetEccFileLength(const ECC_PARAM& ecc_param, uint64_t file_length) {
+		return GetEccLength(ecc_param, file_length);
+	}
+
 	bool CreateEccFile(
 		const std::string& raw_file,
 		const std::string& ecc_file,
 		const ECC_PARAM& ecc_param,
 		ECC_CALLBACK_FUNC func = nullptr,
-		uint32_t thread_count = 0/* 0 for all cpu */)
+		uint32_t thread_count = 0/* 0 for the tuned count, all cpu untuned */)
 	{
-		std::ifstream raw_stream;
-		raw_stream.open(raw_file, std::ios::in | std::ios::binary);
-		if (!raw_stream.is_open()) {
-			return false;
-		}
-
-		std::ofstream ecc_stream;
-		ecc_stream.open(ecc_file, std::ios::out | std::ios::binary);
-		if (!ecc_stream.is_open()) {
-			return false;
-		}
+		return CreateEccFiles(
+			std::vector<std::string>(1, raw_file),
+			std::vector<std::string>(1, ecc_file),
+			ecc_param, func, thread_count);
+	}
 
-		raw_stream.seekg(0, std::ios::end);
-		uint64_t ui64FileLength = raw_stream.tellg();
-		raw_stream.seekg(0, std::ios::beg);
+	// encode raw_files[i] into ecc_files[i], every ecc file is the same as from CreateEccFile
+	// the coder and the threads are set up once, and small files share rounds of coding,
+	// so a batch of many small files does not pay a full stripe of setup for each one
+	// a file that fails makes the result false, the others are still done
+	bool CreateEccFiles(
+		const std::vector<std::string>& raw_files,
+		const std::vector<std::string>& ecc_files,
+		const ECC_PARAM& ecc_param,
+		ECC_CALLBACK_FUNC func = nullptr,
+		uint32_t thread_count = 0/* 0 for the tuned count, all cpu untuned */)
+	{
+		return CreateEccFiles(raw_files, ecc_files, std::vector<ECC_PARAM>(raw_files.size(), ecc_param), func, thread_count);
+	}
 
-		if (!WriteEccHeader(ecc_stream, ecc_param, ui64FileLength)) {
+	// as above, raw_files[i] with ecc_params[i], such as CreateEccParam gives for its length
+	// files of the same ECC_PARAM are queued one after another, lines of different ones can not share a round
+	bool CreateEccFiles(
+		const std::vector<std::string>& raw_files,
+		const std::vector<std::string>& ecc_files,
+		const std::vector<ECC_PARAM>& ecc_params,
+		ECC_CALLBACK_FUNC func = nullptr,
+		uint32_t thread_count = 0/* 0 for the tuned count, all cpu untuned */)
+	{
+		if (raw_files.size() != ecc_files.size() || raw_files.size() != ecc_params.size()) {
 			return false;
 		}
-
-		uint32_t max_thread_count = std::thread::hardware_concurrency();
-		if (thread_count == 0 || thread_count>max_thread_count) {
-			thread_count = max_thread_count;
-		}
-
-		std::vector<
-			std::tuple<
-			bool,
-			std::thread,
-			std::future<uint32_t>
-			>
-		>  vthread(thread_count);
-
-		IReedSolomonCoder* pCoder = CreateEccCoder(ecc_param);
-		assert(pCoder);
-		pCoder->Init();
-
-		uint8_t* read_buff = new uint8_t[ecc_param.ui32Intertwine*ecc_param.ui32ChunkSize*(ecc_param.ui32ChunkCount - ecc_param.ui32EccCount)];
-		//[ecc_param.ui32ChunkCount-ecc_param.ui32EccCount][ecc_param.ui32Intertwine][ecc_param.ui32ChunkSize]
-		uint8_t* code_buff = new uint8_t[ecc_param.ui32Intertwine*ecc_param.ui32ChunkSize*ecc_param.ui32ChunkCount];
-		//[ecc_param.ui32Intertwine][ecc_param.ui32ChunkCount][ecc_param.ui32ChunkSize]
-
-		uint32_t ecc_codeword_size = ecc_param.ui32CodeWordBits / Bit::BITS_PER_UINT8;
-		uint32_t ecc_chunk_size = ecc_param.ui32ChunkSize;
-		uint32_t ecc_chunk_count = ecc_param.ui32ChunkCount;
-		uint32_t ecc_code_count = ecc_param.ui32EccCount;
-		uint32_t ecc_data_count = ecc_chunk_count - ecc_code_count;
-		uint64_t read_length = ecc_param.ui32Intertwine*ecc_data_count*ecc_chunk_size;
-
-		for (uint64_t read_offset = 0; read_offset<ui64FileLength; read_offset += read_length) {
-
-			uint32_t read_real_length = (uint32_t)std::min(ui64FileLength - read_offset, (uint64_t)read_length);
-			uint32_t read_chunk_count = (read_real_length + ecc_chunk_size - 1) / ecc_chunk_size;
-			uint32_t read_intertwinet = (read_chunk_count + ecc_data_count - 1) / ecc_data_count;
-
-			uint32_t buff_line_size = read_intertwinet*ecc_chunk_size;
-			uint32_t code_line_size = ecc_chunk_count*ecc_chunk_size;
-			uint32_t code_ecc_size = ecc_code_count*ecc_chunk_size - ecc_codeword_size;
-			uint32_t code_ecc_offset = ecc_data_count*ecc_chunk_size + ecc_codeword_size;
-
-			raw_stream.read((char*)read_buff, read_real_length);
-			for (uint32_t i = read_real_length; i<buff_line_size*ecc_data_count; i++) {
-				read_buff[i] = 0;
-			}
-			//transpose
-			for (uint32_t i = 0; i<read_intertwinet; i++) {
-				for (uint32_t j = 0; j<ecc_data_count; j++) {
-					//code_buff[i][j]=read_buff[j][i]
-					memcpy(
-						&code_buff[(i*ecc_chunk_count + j)*ecc_chunk_size],
-						&read_buff[(j*read_intertwinet + i)*ecc_chunk_size],
-						ecc_chunk_size);
-				}
-				code_buff[(i*ecc_chunk_count + ecc_data_count)*ecc_chunk_size] = 0;
+		std::vector<size_t> order(raw_files.size());
+		for (size_t f = 0; f<order.size(); f++) {
+			order[f] = f;
+		}
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+			return memcmp(&ecc_params[a], &ecc_params[b], sizeof(ECC_PARAM))<0;
+		});
+
+		StartWorkerPool(thread_count);
+		StartReporter(func);
+
+		CODER_ROUND round;
+		bool bRound = false;
+
+		bool bError = false;
+		bool bBreak = false;
+		for (size_t i = 0; i<order.size() && !bBreak; i++) {
+			size_t f = order[i];
+			std::unique_ptr<FILE_TASK> pTask(new FILE_TASK);
+			pTask->raw_reader.reset(FileIO::OpenReader(raw_files[f], m_ui32IoBackend, m_ui32IoDepth));
+			if (!pTask->raw_reader) {
+				bError = true;
+				continue;
 			}
-
-			for (uint32_t i = 0, j = 0; i<thread_count; i++) {
-				uint32_t begin_line = j;
-				uint32_t end_line = read_intertwinet*(i + 1) / thread_count;
-
-				std::get<0>(vthread[i]) = false;
-				if (end_line>begin_line) {
-					j = end_line;
-
-					std::promise<uint32_t> thread_exitcode;
-					std::get<0>(vthread[i]) = true;
-					std::get<2>(vthread[i]) = thread_exitcode.get_future();
-					std::get<1>(vthread[i]) = std::thread(&ecc_encode,
-						std::make_tuple(pCoder, code_ecc_offset),
-						std::make_tuple(code_buff, code_line_size, begin_line, end_line),
-						std::make_tuple(func, read_offset, ui64FileLength),
-						std::move(thread_exitcode));
-				}
+			pTask->writer.reset(FileIO::OpenWriter(ecc_files[f], m_ui32IoBackend, m_ui32IoDepth));
+			if (!pTask->writer) {
+				bError = true;
+				continue;
 			}
-
-			bool bBreak = false;
-			for (uint32_t i = 0; i<thread_count; i++) {
-				if (std::get<0>(vthread[i])) {
-					std::get<1>(vthread[i]).join();
-					uint32_t exit_code = std::get<2>(vthread[i]).get();
-					if (exit_code == CODER_BREAK) {
-						bBreak = true;
-					}
+			if (!bRound || memcmp(&round.param, &ecc_params[f], sizeof(ECC_PARAM)) != 0) {
+				if (bRound && !FlushRound(round, bBreak)) {
+					bError = true;
 				}
+				if (bBreak) {
+					break;
+				}
+				ResetRound(round, ecc_params[f]);
+				bRound = true;
 			}
-			for (uint32_t i = 0; i<read_intertwinet; i++) {
-				ecc_stream.write((char*)&code_buff[i*code_line_size + code_ecc_offset], code_ecc_size);
-			}
-			if (bBreak) {
-				break;
+			if (!QueueEncodeTask(round, std::move(pTask), bBreak)) {
+				bError = true;
 			}
 		}
-
-		delete[] read_buff;
-		delete[] code_buff;
-
-		delete pCoder;
-
-		return true;
+		if (bRound && !FlushRound(round, bBreak)) {
+			bError = true;
+		}
+		m_pReporter.reset();
+		return !bError;
 	}
 
-	bool CheckEccFile(
+	// bring ecc_file up to date after raw_file grew, with the ECC_PARAM it was made with
+	// stripes that were full stay as they are, the last one, which was partial, is encoded again
+	// together with everything after it, so the cost follows the appended bytes, not the file size
+	// the result is the same as a new CreateEccFile, provided raw_file was only appended to
+	// a file that outgrew the shortened code CreateEccParam gave it is encoded anew with the one it gives now,
+	// such a file is a quarter of a line at most
+	bool AppendEccFile(
 		const std::string& raw_file,
 		const std::string& ecc_file,
-		const std::string& fix_file,
 		ECC_CALLBACK_FUNC func = nullptr,
-		uint32_t thread_count = 0/* 0 for all cpu */)
+		uint32_t thread_count = 0/* 0 for the tuned count, all cpu untuned */)
 	{
-		std::ifstream raw_stream;
-		raw_stream.open(raw_file, std::ios::in | std::ios::binary);
-		if (!raw_stream.is_open()) {
+		std::unique_ptr<FILE_TASK> pTask(new FILE_TASK);
+		uint64_t old_length = 0;
+		{
+			std::unique_ptr<IFileReader> ecc_reader(FileIO::OpenReader(ecc_file, m_ui32IoBackend, m_ui32IoDepth));
+			if (!ecc_reader || !ReadEccHeader(*ecc_reader, pTask->ecc_param, old_length)) {
+				return false;
+			}
+		}
+		pTask->raw_reader.reset(FileIO::OpenReader(raw_file, m_ui32IoBackend, m_ui32IoDepth));
+		if (!pTask->raw_reader) {
 			return false;
 		}
-
-		std::ifstream ecc_stream;
-		ecc_stream.open(ecc_file, std::ios::in | std::ios::binary);
-		if (!ecc_stream.is_open()) {
+		pTask->ui64FileLength = pTask->raw_reader->GetLength();
+		if (pTask->ui64FileLength == FileIO::UNKNOWN_LENGTH || pTask->ui64FileLength<old_length) {
 			return false;
 		}
-
-		std::ofstream fix_stream;
-		fix_stream.open(fix_file, std::ios::out | std::ios::binary);
-		if (!fix_stream.is_open()) {
+		ECC_PARAM new_param = RefitEccParam(pTask->ecc_param, pTask->ui64FileLength);
+		ECC_PARAM old_param = RefitEccParam(pTask->ecc_param, old_length);
+		if (memcmp(&old_param, &pTask->ecc_param, sizeof(ECC_PARAM)) == 0 && memcmp(&new_param, &pTask->ecc_param, sizeof(ECC_PARAM)) != 0) {
+			pTask.reset();
+			return CreateEccFile(raw_file, ecc_file, new_param, func, thread_count);
+		}
+		pTask->writer.reset(FileIO::OpenUpdater(ecc_file));
+		if (!pTask->writer) {
 			return false;
 		}
-
-		ECC_PARAM ecc_param;
-		uint64_t ui64FileLength = 0;
-		if (!ReadEccHeader(ecc_stream, ecc_param, ui64FileLength)) {
+		uint64_t new_length = pTask->ui64FileLength;
+
+		StartWorkerPool(thread_count);
+		StartReporter(func);
+
+		CODER_ROUND round;
+		ResetRound(round, pTask->ecc_param);
+
+		//the header first, a stream ecc file loses its trailer with the truncation below
+		uint8_t header[CReedSolomonCoder8::N];
+		EncodeEccHeader(pTask->ecc_param, pTask->ui64FileLength, header);
+		bool bError = !pTask->writer->WriteAt(0, header, sizeof(header));
+
+		pTask->ui64EccOffset = CReedSolomonCoder8::N;
+		pTask->vRanges.push_back(BYTE_RANGE(old_length - old_length%round.layout.ui64StripeLength, UINT64_MAX));
+		pTask->bWriteAt = true;
+		pTask->bStreaming = false;
+		pTask->bQueued = false;
+		pTask->bFailed = bError;
+
+		bool bBreak = false;
+		round.vTask.push_back(std::move(pTask));
+		if (!QueueFile(round, round.vTask.back().get(), bBreak)) {
+			bError = true;
+		}
+		if (!FlushRound(round, bBreak)) {
+			bError = true;
+		}
+		m_pReporter.reset();
+		if (bError || bBreak) {
 			return false;
 		}
+		return FileIO::TruncateFile(ecc_file, GetEccLength(round.param, new_length));
+	}
 
+	// bytes of raw file that shard shard_index of shard_count encodes, whole stripes, shards in file order
+	// its parity is [GetEccFileLength(first), GetEccFileLength(first+second)) of the ecc file
+	static BYTE_RANGE GetShardRange(const ECC_PARAM& ecc_param, uint64_t file_length, uint32_t shard_index, uint32_t shard_count) {
+		uint64_t stripe_length = (uint64_t)ecc_param.ui32Intertwine*(ecc_param.ui32ChunkCount - ecc_param.ui32EccCount)*ecc_param.ui32ChunkSize;
+		uint64_t stripe_count = (file_length + stripe_length - 1) / stripe_length;
+		uint64_t begin = std::min(file_length, stripe_count*shard_index / shard_count*stripe_length);
+		uint64_t end = std::min(file_length, stripe_count*(shard_index + 1) / shard_count*stripe_length);
+		return BYTE_RANGE(begin, end - begin);
+	}
 
-		uint32_t max_thread_count = std::thread::hardware_concurrency();
-		if (thread_count == 0 || thread_count>max_thread_count) {
-			thread_count = max_thread_count;
+	// encode only the stripes of shard shard_index of shard_count, see GetShardRange, so that one large file
+	// can be encoded by several processes or hosts at once, each with the same ECC_PARAM
+	// ecc_file gets the header and the shard's parity at the offsets it has in the ecc file, the rest is left as it is,
+	// and once the parity is written a SHARD_RECORD of the shard behind it: shards may write files of their own
+	// or one ecc file on a shared file system, either way MergeEccShards checks them and puts the ecc file together
+	bool CreateEccShard(
+		const std::string& raw_file,
+		const std::string& ecc_file,
+		const ECC_PARAM& ecc_param,
+		uint32_t shard_index,
+		uint32_t shard_count,
+		ECC_CALLBACK_FUNC func = nullptr,
+		uint32_t thread_count = 0/* 0 for the tuned count, all cpu untuned */)
+	{
+		if (shard_index >= shard_count) {
+			return false;
 		}
+		std::unique_ptr<FILE_TASK> pTask(new FILE_TASK);
+		pTask->raw_reader.reset(FileIO::OpenReader(raw_file, m_ui32IoBackend, m_ui32IoDepth));
+		if (!pTask->raw_reader) {
+			return false;
+		}
+		//a pipe can not be split, its length is not known before its end
+		pTask->ui64FileLength = pTask->raw_reader->GetLength();
+		if (pTask->ui64FileLength == FileIO::UNKNOWN_LENGTH) {
+			return false;
+		}
+		pTask->writer.reset(FileIO::OpenUpdater(ecc_file));
+		if (!pTask->writer) {
+			return false;
+		}
+		uint64_t file_length = pTask->ui64FileLength;
+		uint64_t record_offset = GetShardRecordOffset(ecc_param, file_length, shard_index);
+
+		StartWorkerPool(thread_count);
+		StartReporter(func);
+
+		CODER_ROUND round;
+		ResetRound(round, ecc_param);
+
+		//every shard writes the same header, a record of an earlier run is cleared until the parity is written again
+		uint8_t header[CReedSolomonCoder8::N];
+		uint8_t record[CReedSolomonCoder8::N];
+		EncodeEccHeader(ecc_param, file_length, header);
+		memset(record, 0, sizeof(record));
+		bool bError = !pTask->writer->WriteAt(0, header, sizeof(header)) ||
+			!pTask->writer->WriteAt(record_offset, record, sizeof(record));
+
+		pTask->ecc_param = ecc_param;
+		pTask->ui64EccOffset = CReedSolomonCoder8::N;
+		pTask->vRanges.push_back(GetShardRange(ecc_param, file_length, shard_index, shard_count));
+		pTask->bWriteAt = true;
+		pTask->bStreaming = false;
+		pTask->bQueued = false;
+		pTask->bFailed = bError;
+
+		bool bBreak = false;
+		round.vTask.push_back(std::move(pTask));
+		if (!QueueFile(round, round.vTask.back().get(), bBreak)) {
+			bError = true;
+		}
+		if (!FlushRound(round, bBreak)) {
+			bError = true;
+		}
+		m_pReporter.reset();
+		if (bError || bBreak) {
+			return false;
+		}
+		//an old and longer ecc file is cut, the parity and records of the later shards are a hole until they are written
+		if (!FileIO::TruncateFile(ecc_file, GetShardRecordOffset(ecc_param, file_length, shard_count))) {
+			return false;
+		}
+		std::unique_ptr<IFileWriter> writer(FileIO::OpenUpdater(ecc_file));
+		if (!writer) {
+			return false;
+		}
+		EncodeShardRecord(ecc_param, file_length, shard_index, shard_count, record);
+		return writer->WriteAt(record_offset, record, sizeof(record)) && writer->Close();
+	}
 
-		std::vector<
-			std::tuple<
-			bool,
-			std::thread,
-			std::future<uint32_t>
-			>
-		> vthread(thread_count);
-
-		IReedSolomonCoder* pCoder = CreateEccCoder(ecc_param);
-		assert(pCoder);
-		pCoder->Init();
-
-		uint8_t* read_buff = new uint8_t[ecc_param.ui32Intertwine*ecc_param.ui32ChunkSize*(ecc_param.ui32ChunkCount - ecc_param.ui32EccCount)];
-		//[ecc_param.ui32ChunkCount-ecc_param.ui32EccCount][ecc_param.ui32Intertwine][ecc_param.ui32ChunkSize]
-		uint8_t* ecc_buff = new uint8_t[ecc_param.ui32Intertwine*ecc_param.ui32ChunkSize*ecc_param.ui32EccCount];
-		//[ecc_param.ui32Intertwine][ecc_param.ui32EccCount][ecc_param.ui32ChunkSize]
-		uint8_t* code_buff = new uint8_t[ecc_param.ui32Intertwine*ecc_param.ui32ChunkSize*ecc_param.ui32ChunkCount];
-		//[ecc_param.ui32Intertwine][ecc_param.ui32ChunkCount][ecc_param.ui32ChunkSize]
-
-		uint32_t ecc_codeword_size = ecc_param.ui32CodeWordBits / Bit::BITS_PER_UINT8;
-		uint32_t ecc_chunk_size = ecc_param.ui32ChunkSize;
-		uint32_t ecc_chunk_count = ecc_param.ui32ChunkCount;
-		uint32_t ecc_code_count = ecc_param.ui32EccCount;
-		uint32_t ecc_data_count = ecc_chunk_count - ecc_code_count;
-		uint64_t read_length = ecc_param.ui32Intertwine*ecc_data_count*ecc_chunk_size;
-
-		for (uint64_t read_offset = 0; read_offset<ui64FileLength; read_offset += read_length) {
-
-			uint32_t read_real_length = (uint32_t)std::min(ui64FileLength - read_offset, (uint64_t)read_length);
-			uint32_t read_chunk_count = (read_real_length + ecc_chunk_size - 1) / ecc_chunk_size;
-			uint32_t read_intertwinet = (read_chunk_count + ecc_data_count - 1) / ecc_data_count;
-
-			uint32_t buff_line_size = read_intertwinet*ecc_chunk_size;
-			uint32_t code_line_size = ecc_chunk_count*ecc_chunk_size;
-			uint32_t code_ecc_size = ecc_code_count*ecc_chunk_size - ecc_codeword_size;
-			uint32_t code_ecc_offset = ecc_data_count*ecc_chunk_size + ecc_codeword_size;
-
-			raw_stream.read((char*)read_buff, read_real_length);
-			for (uint32_t i = read_real_length; i<buff_line_size*ecc_data_count; i++) {
-				read_buff[i] = 0;
+	// put the ecc file together from the files of CreateEccShard, shard_files[i] made as shard i of shard_files.size()
+	// each shard is checked by its SHARD_RECORD to be done, at its place, of the same raw file length and ECC_PARAM,
+	// ecc_file is the same as from CreateEccFile
+	// shards of one shared ecc file give it once for every shard, it may be ecc_file itself: the merge is written
+	// to ecc_file.tmp and moves over ecc_file only when it is complete
+	bool MergeEccShards(
+		const std::vector<std::string>& shard_files,
+		const std::string& ecc_file)
+	{
+		if (shard_files.empty()) {
+			return false;
+		}
+		uint32_t shard_count = (uint32_t)shard_files.size();
+		std::vector<std::unique_ptr<IFileReader>> readers;
+		ECC_PARAM ecc_param;
+		uint64_t file_length = 0;
+		for (uint32_t i = 0; i<shard_count; i++) {
+			ECC_PARAM shard_param;
+			uint64_t shard_length;
+			readers.emplace_back(FileIO::OpenReader(shard_files[i], m_ui32IoBackend, m_ui32IoDepth));
+			if (!readers[i] || !ReadEccHeader(*readers[i], shard_param, shard_length)) {
+				return false;
 			}
-
-			//transpose
-			for (uint32_t i = 0; i<read_intertwinet; i++) {
-				for (uint32_t j = 0; j<ecc_data_count; j++) {
-					//code_buff[i][j]=read_buff[j][i]
-					memcpy(
-						&code_buff[(i*ecc_chunk_count + j)*ecc_chunk_size],
-						&read_buff[(j*read_intertwinet + i)*ecc_chunk_size],
-						ecc_chunk_size);
-				}
-				code_buff[(i*ecc_chunk_count + ecc_data_count)*ecc_chunk_size] = 0;
+			if (i == 0) {
+				ecc_param = shard_param;
+				file_length = shard_length;
+			}
+			else if (memcmp(&shard_param, &ecc_param, sizeof(ECC_PARAM)) != 0 || shard_length != file_length) {
+				return false;
 			}
+			SHARD_RECORD record;
+			if (!ReadShardRecord(*readers[i], GetShardRecordOffset(ecc_param, file_length, i), record) ||
+				record.ui32ShardIndex != i || record.ui32ShardCount != shard_count ||
+				memcmp(&record.param, &ecc_param, sizeof(ECC_PARAM)) != 0 || record.ui64FileLength != file_length) {
+				return false;
+			}
+		}
 
-			for (uint32_t i = 0; i<read_intertwinet; i++) {
-				ecc_stream.read((char*)&code_buff[i*code_line_size + code_ecc_offset], code_ecc_size);
+		std::string tmp_file = ecc_file + ".tmp";
+		std::unique_ptr<IFileWriter> writer(FileIO::OpenWriter(tmp_file, m_ui32IoBackend, m_ui32IoDepth));
+		if (!writer) {
+			return false;
+		}
+		CLargeBuffer buff;
+		bool bError = !buff.reset(MERGE_COPY_SIZE) || !WriteEccHeader(*writer, ecc_param, file_length);
+		for (uint32_t i = 0; i<shard_count && !bError; i++) {
+			BYTE_RANGE range = GetShardRange(ecc_param, file_length, i, shard_count);
+			uint64_t begin = GetEccLength(ecc_param, range.first);
+			uint64_t end = GetEccLength(ecc_param, range.first + range.second);
+			for (uint64_t offset = begin; offset<end && !bError; offset += MERGE_COPY_SIZE) {
+				uint32_t length = (uint32_t)std::min<uint64_t>(MERGE_COPY_SIZE, end - offset);
+				bError = !readers[i]->Read(offset, length, buff.get()) || !writer->Write(buff.get(), length);
 			}
+		}
+		if (!writer->Close()) {
+			bError = true;
+		}
+		writer.reset();
+		readers.clear();
+		if (bError || !FileIO::RenameFile(tmp_file, ecc_file)) {
+			remove(tmp_file.c_str());
+			return false;
+		}
+		return true;
+	}
 
-			for (uint32_t i = 0, j = 0; i<thread_count; i++) {
-				uint32_t begin_line = j;
-				uint32_t end_line = read_intertwinet*(i + 1) / thread_count;
+	bool CheckEccFile(
+		const std::string& raw_file,
+		const std::string& ecc_file,
+		const std::string& fix_file,
+		ECC_CALLBACK_FUNC func = nullptr,
+		uint32_t thread_count = 0/* 0 for the tuned count, all cpu untuned */)
+	{
+		return CheckEccFiles(
+			std::vector<std::string>(1, raw_file),
+			std::vector<std::string>(1, ecc_file),
+			std::vector<std::string>(1, fix_file),
+			func, thread_count);
+	}
 
-				std::get<0>(vthread[i]) = false;
-				if (end_line>begin_line) {
-					j = end_line;
+	// repair only the stripes and lines that hold a byte of ranges, reading them and their parity
+	// straight from their offsets, the rest of raw_file is not touched
+	// the repaired lines are written at their own offsets into fix_file, which is updated in place:
+	// usually raw_file itself or a copy of it, a new fix_file only holds those lines
+	bool CheckEccFileRanges(
+		const std::string& raw_file,
+		const std::string& ecc_file,
+		const std::string& fix_file,
+		const std::vector<BYTE_RANGE>& ranges,
+		ECC_CALLBACK_FUNC func = nullptr,
+		uint32_t thread_count = 0/* 0 for the tuned count, all cpu untuned */)
+	{
+		if (ranges.empty()) {
+			return true;
+		}
+		return CheckFiles(
+			std::vector<std::string>(1, raw_file),
+			std::vector<std::string>(1, ecc_file),
+			std::vector<std::string>(1, fix_file),
+			ranges, func, thread_count);
+	}
 
-					std::promise<uint32_t> thread_exitcode;
-					std::get<0>(vthread[i]) = true;
-					std::get<2>(vthread[i]) = thread_exitcode.get_future();
-					std::get<1>(vthread[i]) = std::thread(&ecc_decode,
-						std::make_tuple(pCoder, code_ecc_offset),
-						std::make_tuple(code_buff, code_line_size, begin_line, end_line),
-						std::make_tuple(func, read_offset, ui64FileLength),
-						std::move(thread_exitcode));
-				}
+	// check raw_files[i] against ecc_files[i] and write the repaired data to fix_files[i]
+	// files encoded with the same ECC_PARAM share coder and rounds as in CreateEccFiles
+	bool CheckEccFiles(
+		const std::vector<std::string>& raw_files,
+		const std::vector<std::string>& ecc_files,
+		const std::vector<std::string>& fix_files,
+		ECC_CALLBACK_FUNC func = nullptr,
+		uint32_t thread_count = 0/* 0 for the tuned count, all cpu untuned */)
+	{
+		return CheckFiles(raw_files, ecc_files, fix_files, std::vector<BYTE_RANGE>(), func, thread_count);
+	}
+protected:
+	//ranges apply to every file, empty to check them whole
+	bool CheckFiles(
+		const std::vector<std::string>& raw_files,
+		const std::vector<std::string>& ecc_files,
+		const std::vector<std::string>& fix_files,
+		const std::vector<BYTE_RANGE>& ranges,
+		ECC_CALLBACK_FUNC func,
+		uint32_t thread_count)
+	{
+		if (raw_files.size() != ecc_files.size() || raw_files.size() != fix_files.size()) {
+			return false;
+		}
+		StartWorkerPool(thread_count);
+		StartReporter(func);
+
+		CODER_ROUND round;
+		bool bRound = false;
+
+		bool bError = false;
+		bool bBreak = false;
+		for (size_t f = 0; f<raw_files.size() && !bBreak; f++) {
+			std::unique_ptr<FILE_TASK> pTask(new FILE_TASK);
+			pTask->raw_reader.reset(FileIO::OpenReader(raw_files[f], m_ui32IoBackend, m_ui32IoDepth));
+			if (!pTask->raw_reader) {
+				bError = true;
+				continue;
 			}
-
-			bool bBreak = false;
-			for (uint32_t i = 0; i<thread_count; i++) {
-				if (std::get<0>(vthread[i])) {
-					std::get<1>(vthread[i]).join();
-					uint32_t exit_code = std::get<2>(vthread[i]).get();
-					if (exit_code == CODER_BREAK) {
-						bBreak = true;
-					}
-				}
+			pTask->ecc_reader.reset(FileIO::OpenReader(ecc_files[f], m_ui32IoBackend, m_ui32IoDepth));
+			if (!pTask->ecc_reader) {
+				bError = true;
+				continue;
+			}
+			//subsets of lines land out of order, that needs WriteAt
+			pTask->vRanges = ranges;
+			pTask->bWriteAt = m_ui64MemoryBudget != 0 || !ranges.empty();
+			if (!ranges.empty()) {
+				pTask->writer.reset(FileIO::OpenUpdater(fix_files[f]));
+			}
+			else {
+				uint32_t fix_backend = pTask->bWriteAt ? (uint32_t)FileIO::IO_BACKEND_STREAM : m_ui32IoBackend;
+				pTask->writer.reset(FileIO::OpenWriter(fix_files[f], fix_backend, m_ui32IoDepth));
+			}
+			if (!pTask->writer) {
+				bError = true;
+				continue;
 			}
 
-			//transpose
-			for (uint32_t i = 0; i<read_intertwinet; i++) {
-				for (uint32_t j = 0; j<ecc_data_count; j++) {
-					//code_buff[i][j]=read_buff[j][i]
-					memcpy(
-						&read_buff[(j*read_intertwinet + i)*ecc_chunk_size],
-						&code_buff[(i*ecc_chunk_count + j)*ecc_chunk_size],
-						ecc_chunk_size);
+			if (!ReadEccHeader(*pTask->ecc_reader, pTask->ecc_param, pTask->ui64FileLength)) {
+				bError = true;
+				continue;
+			}
+			pTask->ui64EccOffset = CReedSolomonCoder8::N;
+			pTask->bStreaming = false;
+			pTask->bQueued = false;
+			pTask->bFailed = false;
+			pTask->ui32Result = IReedSolomonCoder::ECC_NOERROR;
+
+			//lines of different parameters can not share a round
+			if (!bRound || memcmp(&round.param, &pTask->ecc_param, sizeof(ECC_PARAM)) != 0) {
+				if (bRound && !FlushRound(round, bBreak)) {
+					bError = true;
+				}
+				if (bBreak) {
+					break;
 				}
+				ResetRound(round, pTask->ecc_param);
+				bRound = true;
 			}
-			fix_stream.write((char*)read_buff, read_real_length);
 
-			if (bBreak) {
-				break;
+			round.vTask.push_back(std::move(pTask));
+			if (!QueueFile(round, round.vTask.back().get(), bBreak)) {
+				bError = true;
 			}
 		}
-
-		delete[] read_buff;
-		delete[] ecc_buff;
-		delete[] code_buff;
-
-		delete pCoder;
-
-		return true;
+		if (bRound && !FlushRound(round, bBreak)) {
+			bError = true;
+		}
+		m_pReporter.reset();
+		return !bError;
 	}
 };
 
@@ -0,0 +1,1211 @@
+#pragma once
+
+#ifndef _FILEIO_HPP_
+#define _FILEIO_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <memory.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#	define FILEIO_HAS_MMAP 1
+#	include <errno.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#else
+#	define FILEIO_HAS_MMAP 0
+#endif
+
+#if defined(_WIN32)
+#	include <io.h>
+#	include <fcntl.h>
+#endif
+
+#define FILEIO_HAS_URING 0
+#if defined(__linux__) && defined(__has_include)
+#	if __has_include(<linux/io_uring.h>)
+#		undef FILEIO_HAS_URING
+#		define FILEIO_HAS_URING 1
+#		include <stdlib.h>
+#		include <errno.h>
+#		include <sys/syscall.h>
+#		include <linux/io_uring.h>
+#	endif
+#endif
+
+namespace FileIO
+{
+
+	enum :uint32_t {
+		IO_BACKEND_STREAM = 0,	//std::ifstream, always available
+		IO_BACKEND_MMAP = 1,	//memory mapped, falls back to stream when unsupported
+		IO_BACKEND_URING = 2,	//io_uring with O_DIRECT, bypasses the page cache, falls back to stream when unsupported
+	};
+
+	enum :uint32_t {
+		DEFAULT_IO_DEPTH = 8,	//requests kept in flight by the asynchronous backend
+	};
+
+	const uint64_t UNKNOWN_LENGTH = UINT64_MAX;	//GetLength of a pipe before its end is reached
+	const char PIPE_FILE[] = "-";				//file name for stdin/stdout
+
+	class IFileReader
+	{
+	public:
+		virtual ~IFileReader() {}
+
+		virtual bool Open(const std::string& file) = 0;
+		virtual uint64_t GetLength() = 0;
+
+		// copy [offset,offset+length) into pBuff
+		virtual bool Read(uint64_t offset, uint32_t length, uint8_t* pBuff) = 0;
+
+		// count rows of length bytes, the first at offset and the next ones stride apart, into pBuff one after another
+		virtual bool ReadRows(uint64_t offset, uint32_t length, uint64_t stride, uint32_t count, uint8_t* pBuff) {
+			for (uint32_t i = 0; i<count; i++) {
+				if (!Read(offset + i*stride, length, pBuff + (size_t)i*length)) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// zero-copy view of [offset,offset+length), writable but private to this process(copy on write)
+		// valid until the next Map or Read, return nullptr if the backend can not map, then use Read
+		virtual uint8_t* Map(uint64_t offset, uint32_t length) = 0;
+
+		// true if [offset,offset+length) is known to be a hole of a sparse file, it reads as zeros
+		// false when it holds data or the backend can not tell
+		virtual bool IsHole(uint64_t /*offset*/, uint64_t /*length*/) { return false; }
+	};
+
+#if FILEIO_HAS_MMAP
+	// asks the file system where the next data is, one lseek and no read
+	inline bool IsHoleAt(int fd, uint64_t offset, uint64_t length) {
+#if defined(SEEK_DATA)
+		off_t data = lseek(fd, (off_t)offset, SEEK_DATA);
+		if (data == (off_t)-1) {
+			return errno == ENXIO;//nothing but hole up to the end of file
+		}
+		return (uint64_t)data >= offset + length;
+#else
+		return false;
+#endif
+	}
+#endif
+
+	class IFileWriter
+	{
+	public:
+		virtual ~IFileWriter() {}
+
+		virtual bool Open(const std::string& file) = 0;
+		// append at the end of what was written so far
+		virtual bool Write(const void* pBuff, uint32_t length) = 0;
+		// write at an absolute offset, do not mix with Write
+		// return false if the backend only appends
+		virtual bool WriteAt(uint64_t /*offset*/, const void* /*pBuff*/, uint32_t /*length*/) { return false; }
+		// memory that is [offset,offset+length) of the file, written there directly instead of through WriteAt
+		// return nullptr if the backend has none
+		virtual uint8_t* Map(uint64_t /*offset*/, uint32_t /*length*/) { return nullptr; }
+		// flush everything, return false if any write failed
+		virtual bool Close() = 0;
+	};
+
+	class CStreamWriter :public IFileWriter
+	{
+	protected:
+		std::ofstream m_stream;
+	public:
+		virtual bool Open(const std::string& file) {
+			m_stream.open(file, std::ios::out | std::ios::binary);
+			return m_stream.is_open();
+		}
+		virtual bool Write(const void* pBuff, uint32_t length) {
+			m_stream.write((const char*)pBuff, length);
+			return !m_stream.fail();
+		}
+		virtual bool WriteAt(uint64_t offset, const void* pBuff, uint32_t length) {
+			m_stream.seekp(offset);
+			return Write(pBuff, length);
+		}
+		virtual bool Close() {
+			m_stream.close();
+			return !m_stream.fail();
+		}
+	};
+
+	// writes into an existing file without truncating it, creates it when missing
+	class CStreamUpdater :public CStreamWriter
+	{
+	public:
+		virtual bool Open(const std::string& file) {
+			m_stream.open(file, std::ios::in | std::ios::out | std::ios::binary);
+			if (!m_stream.is_open()) {
+				m_stream.clear();
+				m_stream.open(file, std::ios::out | std::ios::binary);
+			}
+			return m_stream.is_open();
+		}
+	};
+
+	class CStreamReader :public IFileReader
+	{
+	protected:
+		std::ifstream m_stream;
+		uint64_t m_ui64Length;
+		uint64_t m_ui64Position;
+#if FILEIO_HAS_MMAP
+		int m_fdHole;	//only to look for holes, the stream has no descriptor to ask
+#endif
+	public:
+		CStreamReader() :m_ui64Length(0), m_ui64Position(0) {
+#if FILEIO_HAS_MMAP
+			m_fdHole = -1;
+#endif
+		}
+		virtual ~CStreamReader() {
+#if FILEIO_HAS_MMAP
+			if (m_fdHole != -1) {
+				close(m_fdHole);
+				m_fdHole = -1;
+			}
+#endif
+		}
+
+		virtual bool Open(const std::string& file) {
+			m_stream.open(file, std::ios::in | std::ios::binary);
+			if (!m_stream.is_open()) {
+				return false;
+			}
+#if FILEIO_HAS_MMAP
+			m_fdHole = open(file.c_str(), O_RDONLY);
+#endif
+			m_stream.seekg(0, std::ios::end);
+			m_ui64Length = m_stream.tellg();
+			m_stream.seekg(0, std::ios::beg);
+			m_ui64Position = 0;
+			return true;
+		}
+		virtual uint64_t GetLength() {
+			return m_ui64Length;
+		}
+		virtual bool Read(uint64_t offset, uint32_t length, uint8_t* pBuff) {
+			if (offset != m_ui64Position) {
+				m_stream.seekg(offset, std::ios::beg);
+			}
+			m_stream.read((char*)pBuff, length);
+			m_ui64Position = offset + length;
+			return !m_stream.fail();
+		}
+		virtual uint8_t* Map(uint64_t /*offset*/, uint32_t /*length*/) {
+			return nullptr;
+		}
+#if FILEIO_HAS_MMAP
+		virtual bool IsHole(uint64_t offset, uint64_t length) {
+			return m_fdHole != -1 && IsHoleAt(m_fdHole, offset, length);
+		}
+#endif
+	};
+
+	// stdin, read strictly forward
+	// the last range asked for stays in memory, so Read and Map may go back inside it but not before it
+	class CPipeReader :public IFileReader
+	{
+	protected:
+		FILE* m_pFile;
+		std::vector<uint8_t> m_vBuff;
+		uint64_t m_ui64Begin;	//stream offset of m_vBuff[0]
+		uint64_t m_ui64Length;
+
+		bool Fill(uint64_t offset, uint32_t length) {
+			if (offset<m_ui64Begin) {
+				return false;
+			}
+			if (offset + length <= m_ui64Begin + m_vBuff.size()) {
+				return true;
+			}
+			//drop what lies before offset, it can not be asked for again
+			size_t drop = (size_t)std::min<uint64_t>(offset - m_ui64Begin, m_vBuff.size());
+			m_vBuff.erase(m_vBuff.begin(), m_vBuff.begin() + drop);
+			m_ui64Begin += drop;
+
+			uint8_t skip[4096];
+			while (m_ui64Begin<offset && m_ui64Length == UNKNOWN_LENGTH) {
+				size_t n = fread(skip, 1, (size_t)std::min<uint64_t>(sizeof(skip), offset - m_ui64Begin), m_pFile);
+				m_ui64Begin += n;
+				if (n == 0) {
+					m_ui64Length = m_ui64Begin;
+				}
+			}
+
+			size_t have = m_vBuff.size();
+			size_t want = (size_t)(offset + length - m_ui64Begin);
+			m_vBuff.resize(want);
+			while (have<want && m_ui64Length == UNKNOWN_LENGTH) {
+				size_t n = fread(&m_vBuff[have], 1, want - have, m_pFile);
+				have += n;
+				if (n == 0) {
+					m_ui64Length = m_ui64Begin + have;
+				}
+			}
+			m_vBuff.resize(have);
+			return have == want;
+		}
+	public:
+		CPipeReader() :m_pFile(nullptr), m_ui64Begin(0), m_ui64Length(UNKNOWN_LENGTH) {
+		}
+
+		virtual bool Open(const std::string& file) {
+			if (file != PIPE_FILE) {
+				return false;
+			}
+#if defined(_WIN32)
+			_setmode(_fileno(stdin), _O_BINARY);
+#endif
+			m_pFile = stdin;
+			return true;
+		}
+		virtual uint64_t GetLength() {
+			return m_ui64Length;
+		}
+		virtual bool Read(uint64_t offset, uint32_t length, uint8_t* pBuff) {
+			if (!Fill(offset, length)) {
+				return false;
+			}
+			memcpy(pBuff, &m_vBuff[(size_t)(offset - m_ui64Begin)], length);
+			return true;
+		}
+		// also reads ahead, a short range means the end was reached and GetLength is known
+		virtual uint8_t* Map(uint64_t offset, uint32_t length) {
+			if (!Fill(offset, length)) {
+				return nullptr;
+			}
+			return &m_vBuff[(size_t)(offset - m_ui64Begin)];
+		}
+	};
+
+	class CPipeWriter :public IFileWriter
+	{
+	protected:
+		FILE* m_pFile;
+	public:
+		CPipeWriter() :m_pFile(nullptr) {
+		}
+
+		virtual bool Open(const std::string& file) {
+			if (file != PIPE_FILE) {
+				return false;
+			}
+#if defined(_WIN32)
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+			m_pFile = stdout;
+			return true;
+		}
+		virtual bool Write(const void* pBuff, uint32_t length) {
+			return fwrite(pBuff, 1, length, m_pFile) == length;
+		}
+		virtual bool Close() {
+			return fflush(m_pFile) == 0 && ferror(m_pFile) == 0;
+		}
+	};
+
+	// a buffer of the caller, as struct iovec
+	struct IO_VECTOR {
+		void* pBase;
+		size_t uiLength;
+	};
+
+	// buffers of the caller laid end to end, the first byte at file offset ui64Offset
+	class CIoVectors
+	{
+	protected:
+		std::vector<IO_VECTOR> m_vVectors;
+		std::vector<uint64_t> m_vOffsets;	//file offset of each vector, then the end
+
+		//the vector holding offset, offset is in [begin,end)
+		size_t Find(uint64_t offset)const {
+			return std::upper_bound(m_vOffsets.begin(), m_vOffsets.end(), offset) - m_vOffsets.begin() - 1;
+		}
+	public:
+		CIoVectors(const IO_VECTOR* pVectors, size_t count, uint64_t ui64Offset) {
+			m_vOffsets.push_back(ui64Offset);
+			for (size_t i = 0; i<count; i++) {
+				if (pVectors[i].uiLength>0) {
+					m_vVectors.push_back(pVectors[i]);
+					m_vOffsets.push_back(m_vOffsets.back() + pVectors[i].uiLength);
+				}
+			}
+		}
+
+		uint64_t GetEnd()const { return m_vOffsets.back(); }
+
+		bool Contains(uint64_t offset, uint64_t length)const {
+			return offset >= m_vOffsets.front() && offset <= GetEnd() && length <= GetEnd() - offset;
+		}
+
+		// the range if it lies in one vector, else nullptr
+		uint8_t* Map(uint64_t offset, uint32_t length)const {
+			if (!Contains(offset, length) || length == 0 || m_vVectors.empty()) {
+				return nullptr;
+			}
+			size_t i = Find(offset);
+			if (offset + length>m_vOffsets[i + 1]) {
+				return nullptr;
+			}
+			return (uint8_t*)m_vVectors[i].pBase + (offset - m_vOffsets[i]);
+		}
+
+		// gather [offset,offset+length) into pBuff, or scatter pBuff there when bScatter
+		bool Copy(uint64_t offset, uint32_t length, uint8_t* pBuff, bool bScatter)const {
+			if (!Contains(offset, length)) {
+				return false;
+			}
+			for (size_t i = length>0 ? Find(offset) : 0; length>0; i++) {
+				uint8_t* pBase = (uint8_t*)m_vVectors[i].pBase + (offset - m_vOffsets[i]);
+				uint32_t part = (uint32_t)std::min<uint64_t>(length, m_vOffsets[i + 1] - offset);
+				if (bScatter) {
+					memcpy(pBase, pBuff, part);
+				}
+				else {
+					memcpy(pBuff, pBase, part);
+				}
+				offset += part;
+				pBuff += part;
+				length -= part;
+			}
+			return true;
+		}
+	};
+
+	// buffers of the caller read as a file, nothing to open
+	// Map hands out the caller's memory itself, it is not copied on write as a file mapping is:
+	// a decoder repairs what it maps in place, see CEccBufferCoder
+	class CIoVectorReader :public IFileReader
+	{
+	protected:
+		CIoVectors m_vectors;
+	public:
+		CIoVectorReader(const IO_VECTOR* pVectors, size_t count, uint64_t offset = 0) :m_vectors(pVectors, count, offset) {
+		}
+
+		virtual bool Open(const std::string& /*file*/) {
+			return false;
+		}
+		virtual uint64_t GetLength() {
+			return m_vectors.GetEnd();
+		}
+		virtual bool Read(uint64_t offset, uint32_t length, uint8_t* pBuff) {
+			return m_vectors.Copy(offset, length, pBuff, false);
+		}
+		virtual uint8_t* Map(uint64_t offset, uint32_t length) {
+			return m_vectors.Map(offset, length);
+		}
+	};
+
+	// writes into buffers of the caller, a write past their end fails
+	class CIoVectorWriter :public IFileWriter
+	{
+	protected:
+		CIoVectors m_vectors;
+		uint64_t m_ui64Position;
+		bool m_bFailed;
+	public:
+		CIoVectorWriter(const IO_VECTOR* pVectors, size_t count, uint64_t offset = 0) :m_vectors(pVectors, count, offset), m_ui64Position(offset), m_bFailed(false) {
+		}
+
+		virtual bool Open(const std::string& /*file*/) {
+			return false;
+		}
+		virtual bool Write(const void* pBuff, uint32_t length) {
+			if (!WriteAt(m_ui64Position, pBuff, length)) {
+				return false;
+			}
+			m_ui64Position += length;
+			return true;
+		}
+		virtual bool WriteAt(uint64_t offset, const void* pBuff, uint32_t length) {
+			if (!m_vectors.Copy(offset, length, (uint8_t*)pBuff, true)) {
+				m_bFailed = true;
+				return false;
+			}
+			return true;
+		}
+		virtual uint8_t* Map(uint64_t offset, uint32_t length) {
+			return m_vectors.Map(offset, length);
+		}
+		virtual bool Close() {
+			return !m_bFailed;
+		}
+	};
+
+#if FILEIO_HAS_MMAP
+	class CMappedReader :public IFileReader
+	{
+	protected:
+		int m_fd;
+		uint8_t* m_pBase;
+		uint64_t m_ui64Length;
+
+		void Advise(uint64_t offset, uint64_t length, int advice) {
+			if (offset >= m_ui64Length) {
+				return;
+			}
+			length = std::min(length, m_ui64Length - offset);
+			uint64_t page_mask = (uint64_t)sysconf(_SC_PAGESIZE) - 1;
+			uint64_t begin = offset&~page_mask;
+			madvise(m_pBase + begin, (size_t)(offset + length - begin), advice);
+		}
+	public:
+		CMappedReader() :m_fd(-1), m_pBase(nullptr), m_ui64Length(0) {
+		}
+		virtual ~CMappedReader() {
+			if (m_pBase != nullptr) {
+				munmap(m_pBase, (size_t)m_ui64Length);
+				m_pBase = nullptr;
+			}
+			if (m_fd != -1) {
+				close(m_fd);
+				m_fd = -1;
+			}
+		}
+
+		virtual bool Open(const std::string& file) {
+			m_fd = open(file.c_str(), O_RDONLY);
+			if (m_fd == -1) {
+				return false;
+			}
+			struct stat st;
+			if (fstat(m_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+				return false;
+			}
+			m_ui64Length = st.st_size;
+			if (m_ui64Length == 0) {
+				return true;
+			}
+			if (m_ui64Length != (size_t)m_ui64Length) {
+				return false;//address space too small, let caller fall back
+			}
+			//private+writable, so a decoder can repair in place without touching the file
+			void* p = mmap(nullptr, (size_t)m_ui64Length, PROT_READ | PROT_WRITE, MAP_PRIVATE, m_fd, 0);
+			if (p == MAP_FAILED) {
+				return false;
+			}
+			m_pBase = (uint8_t*)p;
+			madvise(m_pBase, (size_t)m_ui64Length, MADV_SEQUENTIAL);
+			return true;
+		}
+		virtual uint64_t GetLength() {
+			return m_ui64Length;
+		}
+		virtual bool Read(uint64_t offset, uint32_t length, uint8_t* pBuff) {
+			if (offset + length>m_ui64Length) {
+				return false;
+			}
+			memcpy(pBuff, m_pBase + offset, length);
+			Advise(offset + length, length, MADV_WILLNEED);
+			return true;
+		}
+		virtual uint8_t* Map(uint64_t offset, uint32_t length) {
+			if (offset + length>m_ui64Length || m_pBase == nullptr) {
+				return nullptr;
+			}
+			//the next window is very likely the next request
+			Advise(offset + length, length, MADV_WILLNEED);
+			return m_pBase + offset;
+		}
+		virtual bool IsHole(uint64_t offset, uint64_t length) {
+			return IsHoleAt(m_fd, offset, length);
+		}
+	};
+#endif
+
+#if FILEIO_HAS_URING
+	// minimal io_uring binding on raw syscalls, one thread submits and reaps
+	class CUring
+	{
+	protected:
+		int m_fd;
+		uint8_t* m_pSqRing;
+		uint8_t* m_pCqRing;
+		size_t m_uiSqRingSize;
+		size_t m_uiCqRingSize;
+		io_uring_sqe* m_pSqes;
+		size_t m_uiSqesSize;
+
+		uint32_t* m_pSqHead;
+		uint32_t* m_pSqTail;
+		uint32_t* m_pSqArray;
+		uint32_t m_uiSqMask;
+		uint32_t m_uiSqEntries;
+		uint32_t m_uiToSubmit;
+
+		uint32_t* m_pCqHead;
+		uint32_t* m_pCqTail;
+		io_uring_cqe* m_pCqes;
+		uint32_t m_uiCqMask;
+
+		int Enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+			return (int)syscall(__NR_io_uring_enter, m_fd, to_submit, min_complete, flags, nullptr, 0);
+		}
+	public:
+		CUring() :m_fd(-1), m_pSqRing(nullptr), m_pCqRing(nullptr), m_pSqes(nullptr), m_uiToSubmit(0) {
+		}
+		~CUring() {
+			if (m_pSqes != nullptr) {
+				munmap(m_pSqes, m_uiSqesSize);
+			}
+			if (m_pCqRing != nullptr && m_pCqRing != m_pSqRing) {
+				munmap(m_pCqRing, m_uiCqRingSize);
+			}
+			if (m_pSqRing != nullptr) {
+				munmap(m_pSqRing, m_uiSqRingSize);
+			}
+			if (m_fd != -1) {
+				close(m_fd);
+			}
+		}
+
+		bool Init(uint32_t entries) {
+			io_uring_params params;
+			memset(&params, 0, sizeof(params));
+			m_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+			if (m_fd<0) {
+				m_fd = -1;
+				return false;
+			}
+
+			m_uiSqRingSize = params.sq_off.array + params.sq_entries*sizeof(uint32_t);
+			m_uiCqRingSize = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+			bool single_mmap = (params.features&IORING_FEAT_SINGLE_MMAP) != 0;
+			if (single_mmap) {
+				m_uiSqRingSize = m_uiCqRingSize = std::max(m_uiSqRingSize, m_uiCqRingSize);
+			}
+
+			void* p = mmap(nullptr, m_uiSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+			if (p == MAP_FAILED) {
+				return false;
+			}
+			m_pSqRing = (uint8_t*)p;
+			if (single_mmap) {
+				m_pCqRing = m_pSqRing;
+			}
+			else {
+				p = mmap(nullptr, m_uiCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+				if (p == MAP_FAILED) {
+					return false;
+				}
+				m_pCqRing = (uint8_t*)p;
+			}
+			m_uiSqesSize = params.sq_entries*sizeof(io_uring_sqe);
+			p = mmap(nullptr, m_uiSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+			if (p == MAP_FAILED) {
+				return false;
+			}
+			m_pSqes = (io_uring_sqe*)p;
+
+			m_pSqHead = (uint32_t*)(m_pSqRing + params.sq_off.head);
+			m_pSqTail = (uint32_t*)(m_pSqRing + params.sq_off.tail);
+			m_pSqArray = (uint32_t*)(m_pSqRing + params.sq_off.array);
+			m_uiSqMask = *(uint32_t*)(m_pSqRing + params.sq_off.ring_mask);
+			m_uiSqEntries = params.sq_entries;
+
+			m_pCqHead = (uint32_t*)(m_pCqRing + params.cq_off.head);
+			m_pCqTail = (uint32_t*)(m_pCqRing + params.cq_off.tail);
+			m_pCqes = (io_uring_cqe*)(m_pCqRing + params.cq_off.cqes);
+			m_uiCqMask = *(uint32_t*)(m_pCqRing + params.cq_off.ring_mask);
+			return true;
+		}
+
+		// queue one request, it is handed to the kernel by the next Submit or Reap
+		bool Prepare(uint8_t opcode, int fd, void* pBuff, uint32_t length, uint64_t offset, uint64_t user_data) {
+			uint32_t tail = *m_pSqTail;
+			uint32_t head = __atomic_load_n(m_pSqHead, __ATOMIC_ACQUIRE);
+			if (tail - head >= m_uiSqEntries) {
+				return false;
+			}
+			uint32_t index = tail&m_uiSqMask;
+			io_uring_sqe* sqe = &m_pSqes[index];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = opcode;
+			sqe->fd = fd;
+			sqe->addr = (uint64_t)(uintptr_t)pBuff;
+			sqe->len = length;
+			sqe->off = offset;
+			sqe->user_data = user_data;
+			m_pSqArray[index] = index;
+			__atomic_store_n(m_pSqTail, tail + 1, __ATOMIC_RELEASE);
+			m_uiToSubmit++;
+			return true;
+		}
+
+		bool Submit() {
+			while (m_uiToSubmit>0) {
+				int ret = Enter(m_uiToSubmit, 0, 0);
+				if (ret<0) {
+					if (errno == EINTR || errno == EAGAIN) continue;
+					return false;
+				}
+				m_uiToSubmit -= ret;
+			}
+			return true;
+		}
+
+		// take one completion, block until there is one
+		bool Reap(uint64_t& user_data, int32_t& result) {
+			if (!Submit()) {
+				return false;
+			}
+			for (;;) {
+				uint32_t head = *m_pCqHead;
+				uint32_t tail = __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE);
+				if (head != tail) {
+					io_uring_cqe* cqe = &m_pCqes[head&m_uiCqMask];
+					user_data = cqe->user_data;
+					result = cqe->res;
+					__atomic_store_n(m_pCqHead, head + 1, __ATOMIC_RELEASE);
+					return true;
+				}
+				if (Enter(0, 1, IORING_ENTER_GETEVENTS)<0 && errno != EINTR) {
+					return false;
+				}
+			}
+		}
+	};
+
+	enum :uint32_t {
+		URING_ALIGNMENT = 4096,			//covers the logical block size of every device we care about
+		URING_REQUEST_SIZE = 1 << 20,	//one request never moves more than this
+	};
+
+	inline uint64_t AlignDown(uint64_t offset) {
+		return offset&~(uint64_t)(URING_ALIGNMENT - 1);
+	}
+	inline uint64_t AlignUp(uint64_t offset) {
+		return AlignDown(offset + URING_ALIGNMENT - 1);
+	}
+
+	inline int OpenDirect(const std::string& file, int flags) {
+		//O_DIRECT is refused by some file systems(tmpfs...), the aligned path still works without it
+		int fd = open(file.c_str(), flags | O_DIRECT, 0644);
+		if (fd == -1 && errno == EINVAL) {
+			fd = open(file.c_str(), flags, 0644);
+		}
+		return fd;
+	}
+
+	inline uint8_t* AllocAligned(size_t size) {
+		void* p = nullptr;
+		if (posix_memalign(&p, URING_ALIGNMENT, size) != 0) {
+			return nullptr;
+		}
+		return (uint8_t*)p;
+	}
+
+	// reads whole windows with up to depth requests in flight, and prefetches
+	// the next window of the same size while the caller works on the current one
+	// ReadRows has the rows of a whole pass in flight at once, one small window per row would wait on each of them
+	class CUringReader :public IFileReader
+	{
+	protected:
+		enum :uint32_t {
+			ROWS_WINDOW = 2,	//staging of ReadRows, windows 0 and 1 take turns for Map
+		};
+
+		struct WINDOW {
+			uint8_t* pBuff;
+			uint64_t ui64Capacity;
+			uint64_t ui64Begin;		//aligned file offset of pBuff[0]
+			uint64_t ui64End;		//aligned, may pass the end of file
+			uint64_t ui64Submit;	//next offset to submit
+			uint32_t uiInflight;
+			bool bFailed;
+		};
+		struct REQUEST {
+			uint32_t uiWindow;
+			uint64_t ui64Offset;
+			uint32_t uiLength;
+			uint8_t* pDest;
+		};
+
+		int m_fd;
+		uint64_t m_ui64Length;
+		uint32_t m_uiDepth;
+		CUring m_uring;
+		WINDOW m_window[3];
+		uint32_t m_uiCurrent;
+		std::vector<REQUEST> m_vRequest;
+		std::vector<uint32_t> m_vFreeRequest;
+
+		void Pump(uint32_t w) {
+			WINDOW& window = m_window[w];
+			while (window.ui64Submit<window.ui64End && !window.bFailed && !m_vFreeRequest.empty()) {
+				uint32_t r = m_vFreeRequest.back();
+				REQUEST& request = m_vRequest[r];
+				request.uiWindow = w;
+				request.ui64Offset = window.ui64Submit;
+				request.uiLength = (uint32_t)std::min<uint64_t>(URING_REQUEST_SIZE, window.ui64End - window.ui64Submit);
+				request.pDest = window.pBuff + (request.ui64Offset - window.ui64Begin);
+				if (!m_uring.Prepare(IORING_OP_READ, m_fd, request.pDest, request.uiLength, request.ui64Offset, r)) {
+					break;
+				}
+				m_vFreeRequest.pop_back();
+				window.ui64Submit += request.uiLength;
+				window.uiInflight++;
+			}
+			if (!m_uring.Submit()) {
+				window.bFailed = true;
+			}
+		}
+
+		bool ReapOne() {
+			uint64_t r;
+			int32_t result;
+			if (!m_uring.Reap(r, result)) {
+				return false;
+			}
+			REQUEST& request = m_vRequest[r];
+			WINDOW& window = m_window[request.uiWindow];
+			if (result<0) {
+				window.bFailed = true;
+			}
+			else if ((uint32_t)result<request.uiLength && request.ui64Offset + result<m_ui64Length) {
+				//short read before eof, queue the rest again
+				request.ui64Offset += result;
+				request.uiLength -= result;
+				request.pDest += result;
+				if (m_uring.Prepare(IORING_OP_READ, m_fd, request.pDest, request.uiLength, request.ui64Offset, r)) {
+					return m_uring.Submit();
+				}
+				window.bFailed = true;
+			}
+			window.uiInflight--;
+			m_vFreeRequest.push_back((uint32_t)r);
+			return true;
+		}
+
+		bool Wait(uint32_t w) {
+			WINDOW& window = m_window[w];
+			for (;;) {
+				Pump(w);
+				Pump(1 - w);//spare requests go to the prefetch
+				if (window.uiInflight == 0 && (window.ui64Submit >= window.ui64End || window.bFailed)) {
+					return !window.bFailed;
+				}
+				//either w has requests in flight, or all of them are taken by the other window
+				if (!ReapOne()) {
+					window.bFailed = true;
+					return false;
+				}
+			}
+		}
+
+		bool Fetch(uint32_t w, uint64_t begin, uint64_t end) {
+			WINDOW& window = m_window[w];
+			Wait(w);//never reuse a buffer the kernel still writes to
+			if (end - begin>window.ui64Capacity) {
+				free(window.pBuff);
+				window.pBuff = AllocAligned((size_t)(end - begin));
+				window.ui64Capacity = window.pBuff == nullptr ? 0 : end - begin;
+				if (window.pBuff == nullptr) {
+					window.ui64Begin = window.ui64End = window.ui64Submit = 0;
+					return false;
+				}
+			}
+			window.ui64Begin = begin;
+			window.ui64End = end;
+			window.ui64Submit = begin;
+			window.bFailed = false;
+			Pump(w);
+			return true;
+		}
+
+		bool Contains(uint32_t w, uint64_t begin, uint64_t end) {
+			WINDOW& window = m_window[w];
+			return !window.bFailed && window.ui64Capacity>0 && window.ui64Begin <= begin && end <= window.ui64End;
+		}
+	public:
+		CUringReader(uint32_t depth) :m_fd(-1), m_ui64Length(0), m_uiDepth(depth), m_uiCurrent(0) {
+			memset(m_window, 0, sizeof(m_window));
+		}
+		virtual ~CUringReader() {
+			if (m_fd != -1) {
+				Wait(0);
+				Wait(1);
+				close(m_fd);
+				m_fd = -1;
+			}
+			free(m_window[0].pBuff);
+			free(m_window[1].pBuff);
+			free(m_window[ROWS_WINDOW].pBuff);
+		}
+
+		virtual bool Open(const std::string& file) {
+			if (m_uiDepth == 0 || !m_uring.Init(m_uiDepth)) {
+				return false;
+			}
+			m_vRequest.resize(m_uiDepth);
+			for (uint32_t i = 0; i<m_uiDepth; i++) {
+				m_vFreeRequest.push_back(m_uiDepth - 1 - i);
+			}
+			m_fd = OpenDirect(file, O_RDONLY);
+			if (m_fd == -1) {
+				return false;
+			}
+			struct stat st;
+			if (fstat(m_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+				return false;
+			}
+			m_ui64Length = st.st_size;
+			return true;
+		}
+		virtual uint64_t GetLength() {
+			return m_ui64Length;
+		}
+		virtual bool Read(uint64_t offset, uint32_t length, uint8_t* pBuff) {
+			uint8_t* p = Map(offset, length);
+			if (p == nullptr) {
+				return false;
+			}
+			memcpy(pBuff, p, length);
+			return true;
+		}
+		virtual bool ReadRows(uint64_t offset, uint32_t length, uint64_t stride, uint32_t count, uint8_t* pBuff) {
+			if (count<2) {
+				return IFileReader::ReadRows(offset, length, stride, count, pBuff);
+			}
+			if (offset + (count - 1)*stride + length>m_ui64Length) {
+				return false;
+			}
+			//each row is aligned on its own, the staging holds the pass
+			uint64_t row_span = AlignUp(length) + URING_ALIGNMENT;
+			WINDOW& window = m_window[ROWS_WINDOW];
+			if (count*row_span>window.ui64Capacity) {
+				free(window.pBuff);
+				window.pBuff = AllocAligned((size_t)(count*row_span));
+				window.ui64Capacity = window.pBuff == nullptr ? 0 : count*row_span;
+				if (window.pBuff == nullptr) {
+					return false;
+				}
+			}
+			window.bFailed = false;
+			uint32_t row = 0;
+			uint64_t submit = AlignDown(offset);
+			for (;;) {
+				while (row<count && !window.bFailed && !m_vFreeRequest.empty()) {
+					uint64_t row_begin = AlignDown(offset + row*stride);
+					uint64_t row_end = AlignUp(offset + row*stride + length);
+					uint32_t r = m_vFreeRequest.back();
+					REQUEST& request = m_vRequest[r];
+					request.uiWindow = ROWS_WINDOW;
+					request.ui64Offset = submit;
+					request.uiLength = (uint32_t)std::min<uint64_t>(URING_REQUEST_SIZE, row_end - submit);
+					request.pDest = window.pBuff + row*row_span + (submit - row_begin);
+					if (!m_uring.Prepare(IORING_OP_READ, m_fd, request.pDest, request.uiLength, request.ui64Offset, r)) {
+						break;
+					}
+					m_vFreeRequest.pop_back();
+					window.uiInflight++;
+					submit += request.uiLength;
+					if (submit >= row_end && ++row<count) {
+						submit = AlignDown(offset + row*stride);
+					}
+				}
+				if (!m_uring.Submit()) {
+					window.bFailed = true;
+				}
+				if (window.uiInflight == 0 && (row >= count || window.bFailed)) {
+					break;
+				}
+				if (!ReapOne()) {
+					return false;
+				}
+			}
+			if (window.bFailed) {
+				return false;
+			}
+			for (uint32_t i = 0; i<count; i++) {
+				uint64_t row_offset = offset + i*stride;
+				memcpy(pBuff + (size_t)i*length, window.pBuff + i*row_span + (row_offset - AlignDown(row_offset)), length);
+			}
+			return true;
+		}
+		virtual uint8_t* Map(uint64_t offset, uint32_t length) {
+			if (offset + length>m_ui64Length) {
+				return nullptr;
+			}
+			uint64_t begin = AlignDown(offset);
+			uint64_t end = AlignUp(offset + length);
+
+			uint32_t w = m_uiCurrent;
+			if (!Contains(w, begin, end)) {
+				w = 1 - w;
+				if (!Contains(w, begin, end) && !Fetch(w, begin, end)) {
+					return nullptr;
+				}
+			}
+			if (!Wait(w)) {
+				return nullptr;
+			}
+			m_uiCurrent = w;
+
+			//keep the disk busy with the next window while the caller works on this one
+			uint64_t next = offset + length;
+			if (next<m_ui64Length) {
+				uint64_t next_begin = AlignDown(next);
+				uint64_t next_end = AlignUp(std::min(next + length, m_ui64Length));
+				if (!Contains(1 - w, next_begin, next_end)) {
+					Fetch(1 - w, next_begin, next_end);
+				}
+			}
+			return m_window[w].pBuff + (offset - m_window[w].ui64Begin);
+		}
+		virtual bool IsHole(uint64_t offset, uint64_t length) {
+			return IsHoleAt(m_fd, offset, length);
+		}
+	};
+
+	// appends through aligned staging buffers, depth of them in flight at once,
+	// the padded tail block is cut off again with ftruncate on Close
+	class CUringWriter :public IFileWriter
+	{
+	protected:
+		struct STAGE {
+			uint8_t* pBuff;
+			uint64_t ui64Offset;
+			uint32_t uiLength;
+			uint32_t uiDone;
+			bool bBusy;
+		};
+
+		int m_fd;
+		uint32_t m_uiDepth;
+		CUring m_uring;
+		std::vector<STAGE> m_vStage;
+		uint32_t m_uiCurrent;
+		uint64_t m_ui64Written;
+		bool m_bFailed;
+
+		bool Submit(uint32_t s) {
+			STAGE& stage = m_vStage[s];
+			uint32_t length = (uint32_t)AlignUp(stage.uiLength);
+			memset(stage.pBuff + stage.uiLength, 0, length - stage.uiLength);
+			stage.bBusy = true;
+			stage.uiDone = 0;
+			if (!m_uring.Prepare(IORING_OP_WRITE, m_fd, stage.pBuff, length, stage.ui64Offset, s) || !m_uring.Submit()) {
+				m_bFailed = true;
+				stage.bBusy = false;
+				return false;
+			}
+			return true;
+		}
+
+		bool ReapOne() {
+			uint64_t s;
+			int32_t result;
+			if (!m_uring.Reap(s, result)) {
+				m_bFailed = true;
+				return false;
+			}
+			STAGE& stage = m_vStage[s];
+			uint32_t length = (uint32_t)AlignUp(stage.uiLength);
+			if (result<0) {
+				m_bFailed = true;
+			}
+			else if (stage.uiDone + result<length) {
+				stage.uiDone += result;
+				if (m_uring.Prepare(IORING_OP_WRITE, m_fd, stage.pBuff + stage.uiDone, length - stage.uiDone, stage.ui64Offset + stage.uiDone, s)
+					&& m_uring.Submit()) {
+					return true;
+				}
+				m_bFailed = true;
+			}
+			stage.bBusy = false;
+			return true;
+		}
+
+		bool WaitIdle(uint32_t s) {
+			while (m_vStage[s].bBusy) {
+				if (!ReapOne()) {
+					return false;
+				}
+			}
+			return true;
+		}
+	public:
+		CUringWriter(uint32_t depth) :m_fd(-1), m_uiDepth(depth), m_uiCurrent(0), m_ui64Written(0), m_bFailed(false) {
+		}
+		virtual ~CUringWriter() {
+			if (m_fd != -1) {
+				Close();
+			}
+			for (size_t i = 0; i<m_vStage.size(); i++) {
+				free(m_vStage[i].pBuff);
+			}
+		}
+
+		virtual bool Open(const std::string& file) {
+			if (m_uiDepth == 0 || !m_uring.Init(m_uiDepth)) {
+				return false;
+			}
+			m_vStage.resize(m_uiDepth);
+			for (uint32_t i = 0; i<m_uiDepth; i++) {
+				m_vStage[i].pBuff = AllocAligned(URING_REQUEST_SIZE);
+				m_vStage[i].ui64Offset = 0;
+				m_vStage[i].uiLength = 0;
+				m_vStage[i].bBusy = false;
+				if (m_vStage[i].pBuff == nullptr) {
+					return false;
+				}
+			}
+			m_fd = OpenDirect(file, O_WRONLY | O_CREAT | O_TRUNC);
+			return m_fd != -1;
+		}
+		virtual bool Write(const void* pBuff, uint32_t length) {
+			const uint8_t* p = (const uint8_t*)pBuff;
+			while (length>0 && !m_bFailed) {
+				STAGE& stage = m_vStage[m_uiCurrent];
+				if (stage.uiLength == 0) {
+					stage.ui64Offset = m_ui64Written;
+				}
+				uint32_t n = std::min(length, URING_REQUEST_SIZE - stage.uiLength);
+				memcpy(stage.pBuff + stage.uiLength, p, n);
+				stage.uiLength += n;
+				m_ui64Written += n;
+				p += n;
+				length -= n;
+				if (stage.uiLength == URING_REQUEST_SIZE) {
+					Submit(m_uiCurrent);
+					m_uiCurrent = (m_uiCurrent + 1) % m_uiDepth;
+					WaitIdle(m_uiCurrent);
+					m_vStage[m_uiCurrent].uiLength = 0;
+				}
+			}
+			return !m_bFailed;
+		}
+		virtual bool Close() {
+			if (m_fd == -1) {
+				return !m_bFailed;
+			}
+			if (m_vStage[m_uiCurrent].uiLength>0) {
+				Submit(m_uiCurrent);
+			}
+			for (uint32_t i = 0; i<m_uiDepth; i++) {
+				WaitIdle(i);
+			}
+			if (ftruncate(m_fd, m_ui64Written) != 0) {
+				m_bFailed = true;
+			}
+			close(m_fd);
+			m_fd = -1;
+			return !m_bFailed;
+		}
+	};
+#endif
+
+	// open with the requested backend, fall back to the stream backend if it fails
+	// PIPE_FILE always opens stdin/stdout whatever the backend
+	// return nullptr if the file can not be opened at all
+	inline IFileReader* OpenReader(const std::string& file, uint32_t backend = IO_BACKEND_STREAM, uint32_t depth = DEFAULT_IO_DEPTH) {
+		IFileReader* pReader = nullptr;
+		if (file == PIPE_FILE) {
+			pReader = new CPipeReader;
+			pReader->Open(file);
+			return pReader;
+		}
+#if FILEIO_HAS_URING
+		if (backend == IO_BACKEND_URING) {
+			pReader = new CUringReader(depth);
+			if (pReader->Open(file)) {
+				return pReader;
+			}
+			delete pReader;
+		}
+#endif
+#if FILEIO_HAS_MMAP
+		if (backend == IO_BACKEND_MMAP) {
+			pReader = new CMappedReader;
+			if (pReader->Open(file)) {
+				return pReader;
+			}
+			delete pReader;
+		}
+#endif
+		pReader = new CStreamReader;
+		if (pReader->Open(file)) {
+			return pReader;
+		}
+		delete pReader;
+		return nullptr;
+	}
+
+	inline IFileWriter* OpenWriter(const std::string& file, uint32_t backend = IO_BACKEND_STREAM, uint32_t depth = DEFAULT_IO_DEPTH) {
+		IFileWriter* pWriter = nullptr;
+		if (file == PIPE_FILE) {
+			pWriter = new CPipeWriter;
+			pWriter->Open(file);
+			return pWriter;
+		}
+#if FILEIO_HAS_URING
+		if (backend == IO_BACKEND_URING) {
+			pWriter = new CUringWriter(depth);
+			if (pWriter->Open(file)) {
+				return pWriter;
+			}
+			delete pWriter;
+		}
+#endif
+		pWriter = new CStreamWriter;
+		if (pWriter->Open(file)) {
+			return pWriter;
+		}
+		delete pWriter;
+		return nullptr;
+	}
+
+	// cut or extend a closed file to length
+	inline bool TruncateFile(const std::string& file, uint64_t length) {
+#if FILEIO_HAS_MMAP
+		return truncate(file.c_str(), (off_t)length) == 0;
+#elif defined(_WIN32)
+		int fd = _open(file.c_str(), _O_RDWR | _O_BINARY);
+		if (fd == -1) {
+			return false;
+		}
+		bool bResult = _chsize_s(fd, length) == 0;
+		_close(fd);
+		return bResult;
+#else
+		return false;
+#endif
+	}
+
+	// move a closed file over target, which is replaced at once where the system allows it
+	inline bool RenameFile(const std::string& file, const std::string& target) {
+#if defined(_WIN32)
+		//rename does not replace on windows
+		remove(target.c_str());
+#endif
+		return rename(file.c_str(), target.c_str()) == 0;
+	}
+
+	// for WriteAt into an existing file, the parts not written keep their content
+	inline IFileWriter* OpenUpdater(const std::string& file) {
+		IFileWriter* pWriter = new CStreamUpdater;
+		if (pWriter->Open(file)) {
+			return pWriter;
+		}
+		delete pWriter;
+		return nullptr;
+	}
+};
+
+
+#endif
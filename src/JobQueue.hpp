@@ -0,0 +1,320 @@
+#pragma once
+
+#ifndef _JOBQUEUE_HPP_
+#define _JOBQUEUE_HPP_
+
+#include "BufferCoder.hpp"
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <chrono>
+
+// coding jobs of many callers on one worker pool, for a server that protects objects as they come in
+// Submit returns at once with a handle, a few job threads then drive the jobs: each one reads, writes
+// and flushes rounds of its job as the blocking call would, but the rounds of all of them take turns
+// on the shared pool, so a job waits for a round of each running job at most, not for their end,
+// and the reads and writes of one job overlap the coding of the others
+// the queue of jobs not yet started is bounded, when it is full Submit waits or fails
+class CEccJobQueue
+{
+public:
+	typedef CEccFileCoder::ECC_PARAM			ECC_PARAM;
+	typedef CEccFileCoder::ECC_CALLBACK_FUNC	ECC_CALLBACK_FUNC;
+	typedef CEccFileCoder::BYTE_RANGE			BYTE_RANGE;
+	typedef CEccBufferCoder::IO_VECTOR			IO_VECTOR;
+
+	// a job is one call of the coder it is handed, it returns that call's result
+	typedef std::function<bool(CEccBufferCoder&)> JOB_FUNC;
+	// called once the job is over, from the job thread that ran it or from Cancel, keep it short
+	typedef std::function<void(bool result)> DONE_FUNC;
+
+	enum :uint32_t {
+		JOB_QUEUED = 0,
+		JOB_RUNNING = 1,
+		JOB_DONE = 2,
+		JOB_CANCELLED = 3,
+	};
+
+	enum :uint32_t {
+		DEFAULT_JOB_THREADS = 4,	//jobs running at once, each holds the buffers of a round
+		DEFAULT_QUEUE_LENGTH = 64,	//jobs waiting to start
+	};
+
+	// handle of a submitted job, any thread may wait on it
+	class CJob
+	{
+		friend class CEccJobQueue;
+	protected:
+		JOB_FUNC m_run;
+		DONE_FUNC m_done;
+		std::mutex m_lock;
+		std::condition_variable m_cvDone;
+		uint32_t m_uiState;
+		bool m_bResult;
+
+		void SetState(uint32_t uiState) {
+			std::lock_guard<std::mutex> guard(m_lock);
+			m_uiState = uiState;
+		}
+
+		//the callback comes first, a waiter may free what the job used as soon as it wakes up
+		void Finish(uint32_t uiState, bool bResult) {
+			if (m_done) {
+				m_done(bResult);
+			}
+			std::lock_guard<std::mutex> guard(m_lock);
+			m_uiState = uiState;
+			m_bResult = bResult;
+			m_cvDone.notify_all();
+		}
+	public:
+		CJob(const JOB_FUNC& run, const DONE_FUNC& done) :m_run(run), m_done(done), m_uiState(JOB_QUEUED), m_bResult(false) {
+		}
+
+		uint32_t GetState() {
+			std::lock_guard<std::mutex> guard(m_lock);
+			return m_uiState;
+		}
+
+		bool IsDone() {
+			uint32_t uiState = GetState();
+			return uiState == JOB_DONE || uiState == JOB_CANCELLED;
+		}
+
+		// wait for the end of the job, return its result, false when it was cancelled
+		bool Wait() {
+			std::unique_lock<std::mutex> guard(m_lock);
+			m_cvDone.wait(guard, [&] { return m_uiState == JOB_DONE || m_uiState == JOB_CANCELLED; });
+			return m_bResult;
+		}
+
+		// return false if the job is still queued or running after ms milliseconds
+		bool WaitFor(uint32_t ms, bool& result) {
+			std::unique_lock<std::mutex> guard(m_lock);
+			if (!m_cvDone.wait_for(guard, std::chrono::milliseconds(ms), [&] { return m_uiState == JOB_DONE || m_uiState == JOB_CANCELLED; })) {
+				return false;
+			}
+			result = m_bResult;
+			return true;
+		}
+	};
+protected:
+	typedef ThreadPool::CWorkerPool CWorkerPool;
+
+	std::shared_ptr<CWorkerPool> m_pPool;
+	std::vector<std::thread> m_vThreads;
+	std::deque<std::shared_ptr<CJob>> m_queJobs;
+	size_t m_uiQueueLength;
+	std::mutex m_lock;
+	std::condition_variable m_cvJob;	//a job was queued, or the queue stops
+	std::condition_variable m_cvRoom;	//a job left the queue
+	bool m_bStop;
+
+	uint32_t m_ui32IoBackend;
+	uint32_t m_ui32IoDepth;
+	uint64_t m_ui64MemoryBudget;
+
+	//every job thread has a coder of its own on the shared pool, kept between jobs
+	void JobLoop() {
+		CEccBufferCoder coder;
+		coder.SetWorkerPool(m_pPool);
+		for (;;) {
+			std::shared_ptr<CJob> job;
+			{
+				std::unique_lock<std::mutex> guard(m_lock);
+				m_cvJob.wait(guard, [&] { return m_bStop || !m_queJobs.empty(); });
+				if (m_queJobs.empty()) {
+					return;
+				}
+				job = m_queJobs.front();
+				m_queJobs.pop_front();
+				job->SetState(JOB_RUNNING);
+				coder.SetIoBackend(m_ui32IoBackend, m_ui32IoDepth);
+				coder.SetMemoryBudget(m_ui64MemoryBudget);
+			}
+			m_cvRoom.notify_one();
+			job->Finish(JOB_DONE, job->m_run(coder));
+		}
+	}
+public:
+	// thread_count coding threads shared by all jobs, 0 for the tuned count, all cpu untuned,
+	// job_threads jobs running at once, queue_length jobs waiting at most
+	CEccJobQueue(
+		uint32_t thread_count = 0,
+		uint32_t job_threads = DEFAULT_JOB_THREADS,
+		uint32_t queue_length = DEFAULT_QUEUE_LENGTH)
+		:m_uiQueueLength(std::max(queue_length, 1u)), m_bStop(false),
+		m_ui32IoBackend(FileIO::IO_BACKEND_STREAM), m_ui32IoDepth(Tuning::GetIoDepth(0)), m_ui64MemoryBudget(0) {
+		thread_count = Tuning::GetThreadCount(thread_count);
+		m_pPool.reset(new CWorkerPool(thread_count));
+		for (uint32_t i = 0; i<std::max(job_threads, 1u); i++) {
+			m_vThreads.push_back(std::thread(&CEccJobQueue::JobLoop, this));
+		}
+	}
+	// jobs still queued are cancelled, running ones are finished
+	~CEccJobQueue() {
+		std::deque<std::shared_ptr<CJob>> queJobs;
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			m_bStop = true;
+			queJobs.swap(m_queJobs);
+		}
+		m_cvJob.notify_all();
+		m_cvRoom.notify_all();
+		for (auto& job : queJobs) {
+			job->Finish(JOB_CANCELLED, false);
+		}
+		for (auto& t : m_vThreads) {
+			t.join();
+		}
+	}
+
+	// as CEccFileCoder::SetIoBackend and SetMemoryBudget, for the jobs that start after the call
+	// the budget is per running job
+	void SetIoBackend(uint32_t backend, uint32_t io_depth = 0) {
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_ui32IoBackend = backend;
+		m_ui32IoDepth = Tuning::GetIoDepth(io_depth);
+	}
+
+	void SetMemoryBudget(uint64_t budget) {
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_ui64MemoryBudget = budget;
+	}
+
+	// queue run, jobs start in the order they were submitted
+	// with the queue full, wait for room if bWait, else return nullptr at once
+	// nullptr as well once the queue is being destroyed
+	std::shared_ptr<CJob> Submit(const JOB_FUNC& run, const DONE_FUNC& done = DONE_FUNC(), bool bWait = true) {
+		std::shared_ptr<CJob> job(new CJob(run, done));
+		{
+			std::unique_lock<std::mutex> guard(m_lock);
+			if (bWait) {
+				m_cvRoom.wait(guard, [&] { return m_bStop || m_queJobs.size()<m_uiQueueLength; });
+			}
+			if (m_bStop || m_queJobs.size() >= m_uiQueueLength) {
+				return nullptr;
+			}
+			m_queJobs.push_back(job);
+		}
+		m_cvJob.notify_one();
+		return job;
+	}
+
+	// CEccFileCoder::CreateEccFile
+	std::shared_ptr<CJob> SubmitEncode(
+		const std::string& raw_file,
+		const std::string& ecc_file,
+		const ECC_PARAM& ecc_param,
+		ECC_CALLBACK_FUNC func = nullptr,
+		const DONE_FUNC& done = DONE_FUNC(),
+		bool bWait = true)
+	{
+		return Submit([=](CEccBufferCoder& coder) {
+			return coder.CreateEccFile(raw_file, ecc_file, ecc_param, func);
+		}, done, bWait);
+	}
+
+	// CEccBufferCoder::CreateEccBuffer, data and ecc must stay valid until the job is done
+	std::shared_ptr<CJob> SubmitEncode(
+		const void* data,
+		uint64_t length,
+		void* ecc,
+		uint64_t ecc_length,
+		const ECC_PARAM& ecc_param,
+		ECC_CALLBACK_FUNC func = nullptr,
+		const DONE_FUNC& done = DONE_FUNC(),
+		bool bWait = true)
+	{
+		return Submit([=](CEccBufferCoder& coder) {
+			return coder.CreateEccBuffer(data, length, ecc, ecc_length, ecc_param, func);
+		}, done, bWait);
+	}
+
+	// CEccBufferCoder::EncodeBuffers, the buffers and parity must stay valid until the job is done
+	std::shared_ptr<CJob> SubmitEncode(
+		const std::vector<IO_VECTOR>& data,
+		void* parity,
+		uint64_t parity_length,
+		const ECC_PARAM& ecc_param,
+		ECC_CALLBACK_FUNC func = nullptr,
+		const DONE_FUNC& done = DONE_FUNC(),
+		bool bWait = true)
+	{
+		return Submit([=](CEccBufferCoder& coder) {
+			return coder.EncodeBuffers(data.data(), data.size(), parity, parity_length, ecc_param, func);
+		}, done, bWait);
+	}
+
+	// CEccBufferCoder::CheckBuffers, true when the buffers were clean or are repaired
+	std::shared_ptr<CJob> SubmitCheck(
+		const std::vector<IO_VECTOR>& data,
+		const void* parity,
+		uint64_t parity_length,
+		const ECC_PARAM& ecc_param,
+		ECC_CALLBACK_FUNC func = nullptr,
+		const DONE_FUNC& done = DONE_FUNC(),
+		bool bWait = true)
+	{
+		return Submit([=](CEccBufferCoder& coder) {
+			uint32_t result;
+			return coder.CheckBuffers(data.data(), data.size(), parity, parity_length, ecc_param, result, func) &&
+				result != ErrorCorrectingCodes::IReedSolomonCoder::ECC_FAILED;
+		}, done, bWait);
+	}
+
+	// CEccFileCoder::CheckEccFile, or CheckEccFileRanges if there are ranges
+	std::shared_ptr<CJob> SubmitCheck(
+		const std::string& raw_file,
+		const std::string& ecc_file,
+		const std::string& fix_file,
+		const std::vector<BYTE_RANGE>& ranges = std::vector<BYTE_RANGE>(),
+		ECC_CALLBACK_FUNC func = nullptr,
+		const DONE_FUNC& done = DONE_FUNC(),
+		bool bWait = true)
+	{
+		return Submit([=](CEccBufferCoder& coder) {
+			return ranges.empty() ?
+				coder.CheckEccFile(raw_file, ecc_file, fix_file, func) :
+				coder.CheckEccFileRanges(raw_file, ecc_file, fix_file, ranges, func);
+		}, done, bWait);
+	}
+
+	// CEccFileCoder::AppendEccFile
+	std::shared_ptr<CJob> SubmitAppend(
+		const std::string& raw_file,
+		const std::string& ecc_file,
+		ECC_CALLBACK_FUNC func = nullptr,
+		const DONE_FUNC& done = DONE_FUNC(),
+		bool bWait = true)
+	{
+		return Submit([=](CEccBufferCoder& coder) {
+			return coder.AppendEccFile(raw_file, ecc_file, func);
+		}, done, bWait);
+	}
+
+	// take a job off the queue before it starts, its done callback gets false
+	// return false if it already started
+	bool Cancel(const std::shared_ptr<CJob>& job) {
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			auto it = std::find(m_queJobs.begin(), m_queJobs.end(), job);
+			if (it == m_queJobs.end()) {
+				return false;
+			}
+			m_queJobs.erase(it);
+		}
+		m_cvRoom.notify_one();
+		job->Finish(JOB_CANCELLED, false);
+		return true;
+	}
+};
+
+
+#endif
@@ -6,11 +6,129 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+
+#if defined(__unix__) || defined(__APPLE__)
+#	define MEMPOOL_HAS_MMAP 1
+#	include <sys/mman.h>
+#else
+#	define MEMPOOL_HAS_MMAP 0
+#endif
 
 
 namespace MemPool
 {
 
+	enum :size_t {
+		HUGE_PAGE_SIZE = 2 << 20,
+		HUGE_PAGE_MIN_SIZE = HUGE_PAGE_SIZE / 4,	//smaller blocks are not worth a whole huge page
+	};
+
+	inline size_t GetLargeLength(size_t size) {
+		if (size<HUGE_PAGE_MIN_SIZE) {
+			return size;
+		}
+		return (size + HUGE_PAGE_SIZE - 1)&~(size_t)(HUGE_PAGE_SIZE - 1);
+	}
+
+	inline std::atomic<bool>& HugePages() {
+		static std::atomic<bool> huge_pages(false);
+		return huge_pages;
+	}
+
+	// off by default: a huge page is resident as a whole, partly used blocks then cost up to 2MB each,
+	// memory a budget set by the user does not see
+	inline void SetHugePages(bool huge_pages) {
+		HugePages() = huge_pages;
+	}
+
+	// zeroed memory for big, long lived blocks, with SetHugePages backed by 2MB pages where the system has them:
+	// reserved hugetlbfs pages first, then transparent huge pages on a 2MB aligned range,
+	// plain pages otherwise, return nullptr when out of memory
+	// the length is rounded the same way either way, so FreeLarge does not depend on the setting
+	inline void* AllocLarge(size_t size) {
+#if MEMPOOL_HAS_MMAP
+		size_t length = GetLargeLength(size);
+		if (length<HUGE_PAGE_MIN_SIZE || !HugePages()) {
+			void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			return p != MAP_FAILED ? p : nullptr;
+		}
+#if defined(MAP_HUGETLB)
+		void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			return p;
+		}
+#endif
+		//over map by a huge page and cut both ends, so the range starts on a huge page boundary
+		uint8_t* pBase = (uint8_t*)mmap(nullptr, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (pBase == MAP_FAILED) {
+			return nullptr;
+		}
+		uint8_t* pAligned = (uint8_t*)(((uintptr_t)pBase + HUGE_PAGE_SIZE - 1)&~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+		if (pAligned != pBase) {
+			munmap(pBase, pAligned - pBase);
+		}
+		if (pAligned + length != pBase + length + HUGE_PAGE_SIZE) {
+			munmap(pAligned + length, pBase + length + HUGE_PAGE_SIZE - (pAligned + length));
+		}
+#if defined(MADV_HUGEPAGE)
+		madvise(pAligned, length, MADV_HUGEPAGE);
+#endif
+		return pAligned;
+#else
+		return calloc(size, 1);
+#endif
+	}
+
+	inline void FreeLarge(void* p, size_t size) {
+		if (p == nullptr) {
+			return;
+		}
+#if MEMPOOL_HAS_MMAP
+		munmap(p, GetLargeLength(size));
+#else
+		free(p);
+#endif
+	}
+
+	// owns one AllocLarge block, in place of std::unique_ptr<uint8_t[]> for stripe sized buffers
+	class CLargeBuffer
+	{
+	protected:
+		uint8_t* m_pBuff;
+		size_t m_uiSize;
+	public:
+		CLargeBuffer() :m_pBuff(nullptr), m_uiSize(0) {
+		}
+		~CLargeBuffer() {
+			reset();
+		}
+		CLargeBuffer(const CLargeBuffer&) = delete;
+		CLargeBuffer& operator=(const CLargeBuffer&) = delete;
+
+		// free the block, then allocate size zeroed bytes if size>0, return false when out of memory
+		bool reset(size_t size = 0) {
+			FreeLarge(m_pBuff, m_uiSize);
+			m_pBuff = nullptr;
+			m_uiSize = 0;
+			if (size>0) {
+				m_pBuff = (uint8_t*)AllocLarge(size);
+				if (m_pBuff == nullptr) {
+					return false;
+				}
+				m_uiSize = size;
+			}
+			return true;
+		}
+
+		uint8_t* get()const { return m_pBuff; }
+		size_t size()const { return m_uiSize; }
+		explicit operator bool()const { return m_pBuff != nullptr; }
+		uint8_t& operator[](size_t i)const { return m_pBuff[i]; }
+	};
+
 	class CDLink
 	{
 	public:
@@ -97,8 +215,13 @@ namespace MemPool
 
 		uint32_t aaa[100];
 
+		//a segment is SEGMENT_BLOCK_COUNT polynomial blocks, several MB for the 16 bits coder
 		void AllocSegment() {
-			NODE_SEGMENT* pSegment = new NODE_SEGMENT;
+			void* p = AllocLarge(sizeof(NODE_SEGMENT));
+			if (p == nullptr) {
+				throw std::bad_alloc();
+			}
+			NODE_SEGMENT* pSegment = new(p) NODE_SEGMENT;
 			pSegment->uiAllocCount = 0;
 			m_dlSegment.PushBack(pSegment);
 			for (uint32_t i = 0; i<SEGMENT_BLOCK_COUNT; i++) {
@@ -115,7 +238,8 @@ namespace MemPool
 				m_dlFreeBlock.Pop(pBlock);
 			}
 			m_dlSegment.Pop(pSegment);
-			delete[] pSegment;
+			pSegment->~NODE_SEGMENT();
+			FreeLarge(pSegment, sizeof(NODE_SEGMENT));
 		}
 
 		NODE_SEGMENT* GetSegment(NODE_BLOCK* pBlock) {
@@ -162,6 +286,14 @@ namespace MemPool
 		CFixedMemPool() {}
 		virtual ~CFixedMemPool() {
 			GarbageCollection();
+			//segments left are still used by objects outliving the pool, such as the shared coders,
+			//leave them allocated, both lists only link nodes that live inside the segments
+			while (!m_dlFreeBlock.Empty()) {
+				m_dlFreeBlock.PopFront();
+			}
+			while (!m_dlSegment.Empty()) {
+				m_dlSegment.PopFront();
+			}
 		}
 	};
 };
@@ -0,0 +1,125 @@
+#pragma once
+
+#ifndef _NUMA_HPP_
+#define _NUMA_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <utility>
+
+#define NUMA_SUPPORTED 0
+#if defined(__linux__) && defined(__has_include)
+#	if __has_include(<linux/mempolicy.h>)
+#		undef NUMA_SUPPORTED
+#		define NUMA_SUPPORTED 1
+#		include <sched.h>
+#		include <unistd.h>
+#		include <sys/syscall.h>
+#		include <linux/mempolicy.h>
+#	endif
+#endif
+
+
+namespace Numa
+{
+
+	// "0-3,8,10-11" -> {0,1,2,3,8,10,11}
+	inline std::vector<uint32_t> ParseList(const std::string& list) {
+		std::vector<uint32_t> v;
+		const char* p = list.c_str();
+		while (*p != 0) {
+			unsigned int first, last;
+			int n = 0;
+			if (sscanf(p, "%u-%u%n", &first, &last, &n) != 2) {
+				n = 0;
+				if (sscanf(p, "%u%n", &first, &n) != 1) {
+					break;
+				}
+				last = first;
+			}
+			for (uint32_t i = first; i <= last; i++) {
+				v.push_back(i);
+			}
+			p += n;
+			while (*p == ',' || *p == '\n' || *p == ' ') {
+				p++;
+			}
+		}
+		return v;
+	}
+
+	inline std::string ReadLine(const std::string& file) {
+		std::string line;
+		FILE* fp = fopen(file.c_str(), "r");
+		if (fp != nullptr) {
+			char buff[4096];
+			if (fgets(buff, sizeof(buff), fp) != nullptr) {
+				line = buff;
+			}
+			fclose(fp);
+		}
+		return line;
+	}
+
+	// usable cpus of every node that has any, node-major
+	// empty when the topology is unknown, the caller then runs without numa placement
+	inline std::vector<std::pair<uint32_t, std::vector<uint32_t>>> GetTopology() {
+		std::vector<std::pair<uint32_t, std::vector<uint32_t>>> nodes;
+#if NUMA_SUPPORTED
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+			return nodes;
+		}
+		std::vector<uint32_t> node_list = ParseList(ReadLine("/sys/devices/system/node/online"));
+		for (uint32_t node : node_list) {
+			std::vector<uint32_t> cpus;
+			for (uint32_t cpu : ParseList(ReadLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"))) {
+				if (cpu<CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+					cpus.push_back(cpu);
+				}
+			}
+			if (!cpus.empty()) {
+				nodes.push_back(std::make_pair(node, cpus));
+			}
+		}
+#endif
+		return nodes;
+	}
+
+	// pin the calling thread, its later first touches then land on the cpu's node
+	inline bool PinThread(uint32_t cpu) {
+#if NUMA_SUPPORTED
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+		return false;
+#endif
+	}
+
+	// prefer node for the pages of [p,p+length) that are not touched yet,
+	// only the whole pages inside the range are affected
+	inline bool BindMemory(void* p, uint64_t length, uint32_t node) {
+#if NUMA_SUPPORTED
+		uint64_t page_mask = (uint64_t)sysconf(_SC_PAGESIZE) - 1;
+		uint64_t begin = ((uint64_t)p + page_mask)&~page_mask;
+		uint64_t end = ((uint64_t)p + length)&~page_mask;
+		if (begin >= end) {
+			return true;
+		}
+		const uint32_t BITS_PER_MASK = sizeof(unsigned long) * 8;
+		std::vector<unsigned long> mask(node / BITS_PER_MASK + 1, 0);
+		mask[node / BITS_PER_MASK] |= 1ul << (node%BITS_PER_MASK);
+		return syscall(__NR_mbind, begin, end - begin, MPOL_PREFERRED, mask.data(), mask.size()*BITS_PER_MASK + 1, 0) == 0;
+#else
+		return false;
+#endif
+	}
+};
+
+
+#endif
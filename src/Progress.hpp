@@ -0,0 +1,197 @@
+#pragma once
+
+#ifndef _PROGRESS_HPP_
+#define _PROGRESS_HPP_
+
+#include <assert.h>
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+
+
+namespace Progress
+{
+
+	// multi producer, single consumer list of events, producers never block
+	// the consumer takes the whole list at once, so there is no ABA to care about
+	template<typename _EventType>
+	class CEventQueue
+	{
+	protected:
+		struct NODE {
+			NODE* pNext;
+			_EventType event;
+		};
+
+		std::atomic<NODE*> m_pHead;
+	public:
+		CEventQueue() :m_pHead(nullptr) {
+		}
+		~CEventQueue() {
+			Drain([](const _EventType&) {});
+		}
+
+		// any thread
+		void Push(const _EventType& event) {
+			NODE* pNode = new NODE;
+			pNode->event = event;
+			pNode->pNext = m_pHead.load(std::memory_order_relaxed);
+			while (!m_pHead.compare_exchange_weak(pNode->pNext, pNode, std::memory_order_release, std::memory_order_relaxed)) {
+			}
+		}
+
+		// one thread at a time, func(event) in the order they were pushed
+		template<typename _Func>
+		void Drain(_Func func) {
+			NODE* pNode = m_pHead.exchange(nullptr, std::memory_order_acquire);
+			NODE* pFirst = nullptr;
+			while (pNode != nullptr) {
+				NODE* pNext = pNode->pNext;
+				pNode->pNext = pFirst;
+				pFirst = pNode;
+				pNode = pNext;
+			}
+			while (pFirst != nullptr) {
+				NODE* pNext = pFirst->pNext;
+				func(pFirst->event);
+				delete pFirst;
+				pFirst = pNext;
+			}
+		}
+	};
+
+	// workers only bump a counter on their own cache line and push the odd failure,
+	// a reporter thread adds the counters up a few times a second and calls back from there,
+	// so the callback never runs on a worker and never needs a lock of its own
+	class CProgressReporter
+	{
+	public:
+		// return false to ask the workers to stop
+		typedef std::function<bool(uint64_t offset, uint32_t length, uint64_t total_length, uint32_t result)> REPORT_FUNC;
+
+		enum :uint32_t {
+			DEFAULT_INTERVAL_MS = 100,
+			CACHE_LINE_SIZE = 64,
+			MAX_REPORT_LENGTH = 1u << 30,
+		};
+
+		struct LINE_EVENT {
+			uint64_t ui64Offset;
+			uint32_t ui32Length;
+			uint64_t ui64TotalLength;
+			uint32_t ui32Result;
+		};
+	protected:
+		struct WORKER_COUNTER {
+			std::atomic<uint64_t> ui64Done;//written by its worker only
+			uint8_t pPadding[CACHE_LINE_SIZE];//keep neighbour counters off the same cache line
+		};
+
+		std::unique_ptr<WORKER_COUNTER[]> m_pCounters;
+		uint32_t m_uiWorkerCount;
+		CEventQueue<LINE_EVENT> m_queEvents;
+		std::atomic<uint64_t> m_ui64TotalLength;
+		std::atomic<bool> m_bStopped;
+
+		REPORT_FUNC m_func;
+		std::mutex m_lockReport;	//between the reporter thread and Report() callers, never a worker
+		uint64_t m_ui64Reported;
+
+		std::thread m_thread;
+		std::mutex m_lock;
+		std::condition_variable m_cvQuit;
+		bool m_bQuit;
+
+		void ReporterLoop(uint32_t uiIntervalMs) {
+			std::unique_lock<std::mutex> guard(m_lock);
+			while (!m_bQuit) {
+				m_cvQuit.wait_for(guard, std::chrono::milliseconds(uiIntervalMs));
+				guard.unlock();
+				Report();
+				guard.lock();
+			}
+		}
+	public:
+		CProgressReporter(uint32_t uiWorkerCount, const REPORT_FUNC& func, uint32_t uiIntervalMs = DEFAULT_INTERVAL_MS)
+			:m_pCounters(new WORKER_COUNTER[uiWorkerCount]), m_uiWorkerCount(uiWorkerCount),
+			m_ui64TotalLength(0), m_bStopped(false), m_func(func), m_ui64Reported(0), m_bQuit(false) {
+			assert(uiWorkerCount>0);
+			for (uint32_t i = 0; i<m_uiWorkerCount; i++) {
+				m_pCounters[i].ui64Done.store(0, std::memory_order_relaxed);
+			}
+			m_thread = std::thread(&CProgressReporter::ReporterLoop, this, uiIntervalMs);
+		}
+		~CProgressReporter() {
+			{
+				std::lock_guard<std::mutex> guard(m_lock);
+				m_bQuit = true;
+			}
+			m_cvQuit.notify_all();
+			m_thread.join();
+			Report();
+		}
+
+		uint32_t GetWorkerCount()const { return m_uiWorkerCount; }
+
+		// total_length passed along with the plain progress
+		void SetTotalLength(uint64_t ui64TotalLength) {
+			m_ui64TotalLength.store(ui64TotalLength, std::memory_order_relaxed);
+		}
+
+		// worker side, length bytes went through without news
+		void Add(uint32_t uiWorker, uint32_t uiLength) {
+			assert(uiWorker<m_uiWorkerCount);
+			std::atomic<uint64_t>& done = m_pCounters[uiWorker].ui64Done;
+			done.store(done.load(std::memory_order_relaxed) + uiLength, std::memory_order_relaxed);
+		}
+
+		// worker side, a line worth a callback of its own
+		void Push(uint64_t ui64Offset, uint32_t uiLength, uint64_t ui64TotalLength, uint32_t uiResult) {
+			LINE_EVENT event = { ui64Offset, uiLength, ui64TotalLength, uiResult };
+			m_queEvents.Push(event);
+		}
+
+		// worker side, cheap enough to ask after every line
+		bool Stopped()const {
+			return m_bStopped.load(std::memory_order_relaxed);
+		}
+
+		// hand everything counted so far to the callback, also called by the reporter thread
+		// plain progress comes as offset = bytes reported before, length = bytes since, result 0,
+		// every pushed event comes as it was pushed, Stopped() turns true once the callback says so
+		// and whatever is left after that is dropped
+		void Report() {
+			std::lock_guard<std::mutex> guard(m_lockReport);
+			bool bContinue = !Stopped();
+			m_queEvents.Drain([&](const LINE_EVENT& event) {
+				if (bContinue) {
+					bContinue = m_func(event.ui64Offset, event.ui32Length, event.ui64TotalLength, event.ui32Result);
+				}
+			});
+
+			uint64_t ui64Done = 0;
+			for (uint32_t i = 0; i<m_uiWorkerCount; i++) {
+				ui64Done += m_pCounters[i].ui64Done.load(std::memory_order_relaxed);
+			}
+			uint64_t ui64TotalLength = m_ui64TotalLength.load(std::memory_order_relaxed);
+			while (bContinue && m_ui64Reported<ui64Done) {
+				uint32_t uiLength = (uint32_t)std::min<uint64_t>(ui64Done - m_ui64Reported, MAX_REPORT_LENGTH);
+				bContinue = m_func(m_ui64Reported, uiLength, ui64TotalLength, 0);
+				m_ui64Reported += uiLength;
+			}
+
+			if (!bContinue) {
+				m_bStopped.store(true, std::memory_order_relaxed);
+			}
+		}
+	};
+};
+
+
+#endif
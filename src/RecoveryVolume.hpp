@@ -0,0 +1,594 @@
+#pragma once
+
+#ifndef _RECOVERYVOLUME_HPP_
+#define _RECOVERYVOLUME_HPP_
+
+#include "ErasureCoder.hpp"
+#include "Crc32.hpp"
+#include "ThreadPool.hpp"
+#include "Progress.hpp"
+#include "FileIO.hpp"
+#include "Tuning.hpp"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <memory.h>
+#include <string.h>
+#include <stddef.h>
+
+// recovery volume of a file: RecoveryCount blocks coded across the DataCount blocks of the file,
+// any RecoveryCount lost or damaged blocks of the file and the volume together can be rebuilt
+// a block is found bad by its crc, so a repair is an erasure decode of the bad blocks only,
+// where CEccFileCoder runs an error locating decode over every line it touches
+// it is meant for whole blocks going missing: unreadable sectors, a truncated or half copied file
+//
+// the volume: VOLUME_HEADER, the crc of every data block then of every recovery block,
+// the recovery blocks of ui32BlockSize bytes each followed by the bitmap of their 65536 words (ui32BlockSize/16 bytes),
+// then the crc table and the header again, the copy is read when the first one does not match its crc
+class CRecoveryVolumeCoder
+{
+public:
+
+	struct VOLUME_PARAM {
+		uint32_t ui32BlockSize;		//multiple of BLOCK_ALIGN
+		uint32_t ui32DataCount;		//blocks of the file, the last one padded with zero
+		uint32_t ui32RecoveryCount;	//DataCount+RecoveryCount <= CErasureCoder::MaxPositions
+		uint32_t ui32Reserved;
+		uint64_t ui64FileLength;
+	};
+
+	// same calls as CEccFileCoder::ECC_CALLBACK_FUNC, a rebuilt block comes with ECC_SUCCESS,
+	// one that can not be rebuilt with ECC_FAILED, both with its own offset and length
+	typedef uint32_t(__stdcall *VOLUME_CALLBACK_FUNC)(uint64_t offset, uint32_t length, uint64_t total_length, uint32_t result);
+
+	enum :uint32_t {
+		CODER_CONTIONUE = 0,
+		CODER_BREAK = 1,
+	};
+
+	enum :uint32_t {
+		BLOCK_ALIGN = 512,						//a sector, and whole bitmap bytes of whole tiles
+		DEFAULT_BLOCK_COUNT = 2000,				//blocks of a file when the block size is left to CreateVolumeParam
+		DEFAULT_MEMORY_BUDGET = 256 << 20,
+	};
+protected:
+	typedef ErrorCorrectingCodes::IReedSolomonCoder	IReedSolomonCoder;
+	typedef ErrorCorrectingCodes::CErasureCoder		CErasureCoder;
+	typedef ErrorDetectingCodes::CCrc32				CCrc32;
+	typedef ThreadPool::CWorkerPool					CWorkerPool;
+	typedef Progress::CProgressReporter				CProgressReporter;
+	typedef FileIO::IFileReader						IFileReader;
+	typedef FileIO::IFileWriter						IFileWriter;
+	typedef MemPool::CLargeBuffer					CLargeBuffer;
+
+	struct VOLUME_HEADER {
+		char		szSign[4];	//"ecc"
+		char		szCoder[4];	//"rv10"
+		VOLUME_PARAM param;
+		uint32_t	ui32TableCrc;	//of the crc table
+		uint32_t	ui32HeaderCrc;	//of the bytes above
+	};
+
+	static uint32_t GetBitmapSize(const VOLUME_PARAM& param) {
+		return param.ui32BlockSize / 16;
+	}
+
+	static uint64_t GetTableSize(const VOLUME_PARAM& param) {
+		return (uint64_t)(param.ui32DataCount + param.ui32RecoveryCount)*sizeof(uint32_t);
+	}
+
+	static uint64_t GetRecoveryOffset(const VOLUME_PARAM& param, uint32_t uiRecovery) {
+		return sizeof(VOLUME_HEADER) + GetTableSize(param) + (uint64_t)uiRecovery*(param.ui32BlockSize + GetBitmapSize(param));
+	}
+
+	//bytes of data block i in the file, the rest of the block is zero
+	static uint32_t GetBlockLength(const VOLUME_PARAM& param, uint32_t i) {
+		uint64_t offset = (uint64_t)i*param.ui32BlockSize;
+		return (uint32_t)std::min<uint64_t>(param.ui32BlockSize, param.ui64FileLength - offset);
+	}
+
+	bool WriteVolumeHeader(IFileWriter& writer, const VOLUME_PARAM& param, const std::vector<uint32_t>& table) {
+		VOLUME_HEADER header;
+		memset(&header, 0, sizeof(header));
+		strncpy(header.szSign, "ecc", 4);
+		memcpy(header.szCoder, "rv10", 4);
+		header.param = param;
+		header.ui32TableCrc = CCrc32::Calc((const uint8_t*)table.data(), table.size()*sizeof(uint32_t));
+		header.ui32HeaderCrc = CCrc32::Calc((const uint8_t*)&header, offsetof(VOLUME_HEADER, ui32HeaderCrc));
+
+		uint64_t trailer_offset = GetRecoveryOffset(param, param.ui32RecoveryCount);
+		uint32_t table_size = (uint32_t)GetTableSize(param);
+		return writer.WriteAt(0, &header, sizeof(header)) &&
+			writer.WriteAt(sizeof(header), table.data(), table_size) &&
+			writer.WriteAt(trailer_offset, table.data(), table_size) &&
+			writer.WriteAt(trailer_offset + table_size, &header, sizeof(header));
+	}
+
+	//header at header_offset, its table at table_offset, false if either does not match its crc
+	static bool ReadVolumeHeader(IFileReader& reader, uint64_t header_offset, uint64_t table_offset, VOLUME_PARAM& param, std::vector<uint32_t>& table) {
+		VOLUME_HEADER header;
+		if (!reader.Read(header_offset, sizeof(header), (uint8_t*)&header)) {
+			return false;
+		}
+		if (memcmp(header.szSign, "ecc", 4) != 0 || memcmp(header.szCoder, "rv10", 4) != 0) {
+			return false;
+		}
+		if (header.ui32HeaderCrc != CCrc32::Calc((const uint8_t*)&header, offsetof(VOLUME_HEADER, ui32HeaderCrc))) {
+			return false;
+		}
+		param = header.param;
+		if (param.ui32BlockSize == 0 || param.ui32BlockSize%BLOCK_ALIGN != 0 ||
+			(uint64_t)param.ui32DataCount + param.ui32RecoveryCount>CErasureCoder::MaxPositions ||
+			(param.ui64FileLength + param.ui32BlockSize - 1) / param.ui32BlockSize != param.ui32DataCount) {
+			return false;
+		}
+		if (table_offset == FileIO::UNKNOWN_LENGTH) {
+			//the trailer, the table is right before its header
+			table_offset = header_offset - GetTableSize(param);
+		}
+		table.resize(param.ui32DataCount + param.ui32RecoveryCount);
+		uint32_t table_size = (uint32_t)GetTableSize(param);
+		if (table_size>0 && !reader.Read(table_offset, table_size, (uint8_t*)table.data())) {
+			return false;
+		}
+		return header.ui32TableCrc == CCrc32::Calc((const uint8_t*)table.data(), table_size);
+	}
+
+	static bool ReadVolumeHeader(IFileReader& reader, VOLUME_PARAM& param, std::vector<uint32_t>& table) {
+		if (ReadVolumeHeader(reader, 0, sizeof(VOLUME_HEADER), param, table)) {
+			return true;
+		}
+		uint64_t length = reader.GetLength();
+		if (length == FileIO::UNKNOWN_LENGTH || length<sizeof(VOLUME_HEADER)) {
+			return false;
+		}
+		return ReadVolumeHeader(reader, length - sizeof(VOLUME_HEADER), FileIO::UNKNOWN_LENGTH, param, table);
+	}
+
+	//words of a row in one pass: the rows of a pass take about the memory budget,
+	//a multiple of the tile so every worker codes whole tiles
+	uint32_t GetSliceWords(const VOLUME_PARAM& param, uint32_t row_count)const {
+		uint32_t block_words = param.ui32BlockSize / 2;
+		uint64_t budget = m_ui64MemoryBudget != 0 ? m_ui64MemoryBudget : (uint64_t)DEFAULT_MEMORY_BUDGET;
+		uint64_t words = budget / (2 * (uint64_t)std::max(row_count, 1u));
+		words = words / CErasureCoder::TILE_WORDS*CErasureCoder::TILE_WORDS;
+		return (uint32_t)std::max<uint64_t>(CErasureCoder::TILE_WORDS, std::min<uint64_t>(words, block_words));
+	}
+
+	//[begin,end) of the words of a slice coded by worker w, tile aligned
+	static std::pair<uint32_t, uint32_t> GetWorkerColumns(uint32_t words, uint32_t w, uint32_t worker_count) {
+		uint32_t tiles = (words + CErasureCoder::TILE_WORDS - 1) / CErasureCoder::TILE_WORDS;
+		uint32_t begin = (uint32_t)((uint64_t)tiles*w / worker_count)*CErasureCoder::TILE_WORDS;
+		uint32_t end = (uint32_t)((uint64_t)tiles*(w + 1) / worker_count)*CErasureCoder::TILE_WORDS;
+		return std::make_pair(std::min(begin, words), std::min(end, words));
+	}
+
+	//bytes [offset,offset+length) of a file of file_length bytes into pBuff, zero past the end
+	//false when the reader fails or the file is shorter than it should be
+	static bool ReadPadded(IFileReader* reader, uint64_t file_length, uint64_t offset, uint32_t length, uint64_t end_of_data, uint8_t* pBuff) {
+		uint32_t real_length = offset<end_of_data ? (uint32_t)std::min<uint64_t>(length, end_of_data - offset) : 0;
+		memset(pBuff + real_length, 0, length - real_length);
+		if (real_length == 0) {
+			return true;
+		}
+		if (reader == nullptr || offset + real_length>file_length) {
+			return false;
+		}
+		return reader->Read(offset, real_length, pBuff);
+	}
+
+	void StartWorkerPool(uint32_t thread_count) {
+		thread_count = Tuning::GetThreadCount(thread_count);
+		if (!m_pPool || m_pPool->GetThreadCount() != thread_count) {
+			m_pPool.reset();
+			m_pPool.reset(new CWorkerPool(thread_count));
+		}
+	}
+
+	void StartReporter(VOLUME_CALLBACK_FUNC func, uint64_t total_length) {
+		m_pReporter.reset();
+		if (func != nullptr) {
+			m_pReporter.reset(new CProgressReporter(m_pPool->GetThreadCount(),
+				[func](uint64_t offset, uint32_t length, uint64_t total_length, uint32_t result) {
+				return (*func)(offset, length, total_length, result) != CODER_BREAK;
+			}));
+			m_pReporter->SetTotalLength(total_length);
+		}
+	}
+
+	bool Stopped()const {
+		return m_pReporter && m_pReporter->Stopped();
+	}
+
+	//crc and check every block of the file, and of the volume, bad[p] for a bad position p of the coder
+	//(bytes, the workers set them side by side),
+	//the blocks read are copied to fix_writer on the way when it is not nullptr
+	bool CheckBlocks(IFileReader* raw_reader, IFileReader& vol_reader, const VOLUME_PARAM& param, const std::vector<uint32_t>& table,
+		IFileWriter* fix_writer, std::vector<uint8_t>& bad) {
+		uint32_t k = param.ui32DataCount;
+		uint32_t m = param.ui32RecoveryCount;
+		uint32_t block_size = param.ui32BlockSize;
+		uint32_t record_size = block_size + GetBitmapSize(param);
+		uint64_t raw_length = raw_reader ? raw_reader->GetLength() : 0;
+		uint64_t vol_length = vol_reader.GetLength();
+		uint64_t budget = m_ui64MemoryBudget != 0 ? m_ui64MemoryBudget : (uint64_t)DEFAULT_MEMORY_BUDGET;
+		uint32_t batch = (uint32_t)std::max<uint64_t>(1, budget / record_size);
+		uint32_t worker_count = m_pPool->GetThreadCount();
+
+		CLargeBuffer buff;
+		if (!buff.reset((size_t)std::min(batch, k + m)*record_size)) {
+			return false;
+		}
+		bad.assign(k + m, 0);
+		std::vector<uint8_t> read_ok(batch);
+		bool bError = false;
+		//the data blocks, then the recovery blocks with their bitmaps
+		for (uint32_t first = 0; first<k + m && !bError && !Stopped(); first += batch) {
+			uint32_t count = std::min(batch, k + m - first);
+			for (uint32_t b = 0; b<count; b++) {
+				uint32_t i = first + b;
+				uint8_t* p = buff.get() + (size_t)b*record_size;
+				if (i<k) {
+					read_ok[b] = ReadPadded(raw_reader, raw_length, (uint64_t)i*block_size, block_size, param.ui64FileLength, p);
+				}
+				else {
+					uint64_t offset = GetRecoveryOffset(param, i - k);
+					read_ok[b] = offset + record_size <= vol_length && vol_reader.Read(offset, record_size, p);
+				}
+			}
+			m_pPool->Run(worker_count, [&](uint32_t w) {
+				for (uint32_t b = w; b<count; b += worker_count) {
+					uint32_t i = first + b;
+					uint32_t size = i<k ? block_size : record_size;
+					bool bGood = read_ok[b] && CCrc32::Calc(buff.get() + (size_t)b*record_size, size) == table[i];
+					//the coder has the recovery blocks first
+					bad[i<k ? m + i : i - k] = !bGood;
+					if (m_pReporter && i<k) {
+						m_pReporter->Add(w, GetBlockLength(param, i));
+					}
+				}
+			});
+			if (fix_writer != nullptr) {
+				for (uint32_t b = 0; b<count && first + b<k; b++) {
+					uint32_t i = first + b;
+					bError |= !fix_writer->Write(buff.get() + (size_t)b*record_size, GetBlockLength(param, i));
+				}
+			}
+		}
+		return !bError;
+	}
+
+	uint64_t m_ui64MemoryBudget;
+	uint32_t m_ui32IoBackend;
+	uint32_t m_ui32IoDepth;
+	std::unique_ptr<CWorkerPool> m_pPool;
+	std::unique_ptr<CProgressReporter> m_pReporter;
+public:
+	CRecoveryVolumeCoder() :m_ui64MemoryBudget(0), m_ui32IoBackend(FileIO::IO_BACKEND_STREAM), m_ui32IoDepth(Tuning::GetIoDepth(0)) {
+	}
+
+	// recovery_percent of the data blocks as recovery blocks, one at least
+	// block_size 0 for about DEFAULT_BLOCK_COUNT blocks, else a multiple of BLOCK_ALIGN:
+	// smaller blocks lose less to a bad sector, more blocks cost more to code
+	static bool CreateVolumeParam(
+		VOLUME_PARAM& param,
+		uint64_t file_length,
+		uint32_t recovery_percent = 5,
+		uint32_t block_size = 0)
+	{
+		if (!(recovery_percent > 0 && recovery_percent <= 100))
+			return false;
+		if (file_length == FileIO::UNKNOWN_LENGTH)
+			return false;
+		if (block_size == 0) {
+			uint64_t size = (file_length + DEFAULT_BLOCK_COUNT - 1) / DEFAULT_BLOCK_COUNT;
+			size = (size + BLOCK_ALIGN - 1) / BLOCK_ALIGN*BLOCK_ALIGN;
+			if (size>UINT32_MAX / 2)
+				return false;
+			block_size = (uint32_t)std::max<uint64_t>(size, BLOCK_ALIGN);
+		}
+		if (block_size%BLOCK_ALIGN != 0)
+			return false;
+
+		uint64_t data_count = (file_length + block_size - 1) / block_size;
+		uint64_t recovery_count = (data_count*recovery_percent + 99) / 100;
+		if (data_count + recovery_count>CErasureCoder::MaxPositions)
+			return false;
+
+		memset(&param, 0, sizeof(param));
+		param.ui32BlockSize = block_size;
+		param.ui32DataCount = (uint32_t)data_count;
+		param.ui32RecoveryCount = (uint32_t)recovery_count;
+		param.ui64FileLength = file_length;
+		return true;
+	}
+
+	// FileIO::IO_BACKEND_STREAM, IO_BACKEND_MMAP or IO_BACKEND_URING for the reads,
+	// the volume and a fix file are written through the stream backend, they are written out of order
+	void SetIoBackend(uint32_t backend, uint32_t io_depth = 0) {
+		m_ui32IoBackend = backend;
+		m_ui32IoDepth = Tuning::GetIoDepth(io_depth);
+	}
+
+	// about budget bytes of blocks in memory at once, 0 for DEFAULT_MEMORY_BUDGET
+	// every block is read in slices of the same words when a whole one of each does not fit
+	void SetMemoryBudget(uint64_t budget) {
+		m_ui64MemoryBudget = budget;
+	}
+
+	// raw_file can not be a pipe, its length decides the blocks
+	bool CreateVolume(
+		const std::string& raw_file,
+		const std::string& vol_file,
+		uint32_t recovery_percent = 5,
+		uint32_t block_size = 0,
+		VOLUME_CALLBACK_FUNC func = nullptr,
+		uint32_t thread_count = 0/* 0 for the tuned count, all cpu untuned */)
+	{
+		std::unique_ptr<IFileReader> raw_reader(FileIO::OpenReader(raw_file, m_ui32IoBackend, m_ui32IoDepth));
+		if (!raw_reader) {
+			return false;
+		}
+		VOLUME_PARAM param;
+		if (!CreateVolumeParam(param, raw_reader->GetLength(), recovery_percent, block_size)) {
+			return false;
+		}
+		std::unique_ptr<IFileWriter> writer(FileIO::OpenWriter(vol_file));
+		if (!writer) {
+			return false;
+		}
+		uint32_t k = param.ui32DataCount;
+		uint32_t m = param.ui32RecoveryCount;
+		std::vector<uint32_t> table(k + m, 0);
+		if (k == 0) {
+			return WriteVolumeHeader(*writer, param, table) && writer->Close();
+		}
+
+		StartWorkerPool(thread_count);
+		StartReporter(func, param.ui64FileLength);
+		uint32_t worker_count = m_pPool->GetThreadCount();
+
+		//encoding is rebuilding every recovery row
+		CErasureCoder coder(k, m);
+		std::vector<uint32_t> erased;
+		for (uint32_t j = 0; j<m; j++) {
+			erased.push_back(coder.GetRecoveryPosition(j));
+		}
+		coder.SetErasures(erased);
+
+		uint32_t block_words = param.ui32BlockSize / 2;
+		uint32_t slice_words = GetSliceWords(param, k + m);
+		CLargeBuffer rows, highs;
+		if (!rows.reset((size_t)(k + m)*slice_words * 2) || !highs.reset((size_t)m*GetBitmapSize(param))) {
+			m_pReporter.reset();
+			return false;
+		}
+		std::vector<const uint16_t*> in_rows(k + m, nullptr);
+		std::vector<const uint8_t*> in_highs(k + m, nullptr);
+		std::vector<uint16_t*> out_rows(m);
+		std::vector<uint8_t*> out_highs(m);
+		for (uint32_t p = 0; p<k + m; p++) {
+			in_rows[p] = (const uint16_t*)rows.get() + (size_t)p*slice_words;
+		}
+		for (uint32_t j = 0; j<m; j++) {
+			out_rows[j] = (uint16_t*)rows.get() + (size_t)coder.GetRecoveryPosition(j)*slice_words;
+		}
+
+		bool bError = false;
+		for (uint32_t first_word = 0; first_word<block_words && !bError && !Stopped(); first_word += slice_words) {
+			uint32_t words = std::min(slice_words, block_words - first_word);
+			for (uint32_t i = 0; i<k && !bError; i++) {
+				uint8_t* p = (uint8_t*)in_rows[coder.GetDataPosition(i)];
+				bError |= !ReadPadded(raw_reader.get(), param.ui64FileLength, (uint64_t)i*param.ui32BlockSize + first_word * 2, words * 2, param.ui64FileLength, p);
+			}
+			if (bError) {
+				break;
+			}
+			for (uint32_t j = 0; j<m; j++) {
+				out_highs[j] = highs.get() + (size_t)j*GetBitmapSize(param) + first_word / 8;
+			}
+			m_pPool->Run(worker_count, [&](uint32_t w) {
+				auto columns = GetWorkerColumns(words, w, worker_count);
+				coder.Rebuild(in_rows.data(), in_highs.data(), out_rows.data(), out_highs.data(), columns.first, columns.second);
+				//crc of every data row, the recovery ones are only whole once every worker is done
+				for (uint32_t i = w; i<k; i += worker_count) {
+					table[i] = CCrc32::Calc((const uint8_t*)in_rows[coder.GetDataPosition(i)], words * 2, table[i]);
+					uint64_t offset = (uint64_t)i*param.ui32BlockSize + first_word * 2;
+					if (m_pReporter && offset<param.ui64FileLength) {
+						m_pReporter->Add(w, (uint32_t)std::min<uint64_t>(words * 2, param.ui64FileLength - offset));
+					}
+				}
+			});
+			m_pPool->Run(worker_count, [&](uint32_t w) {
+				for (uint32_t j = w; j<m; j += worker_count) {
+					table[k + j] = CCrc32::Calc((const uint8_t*)out_rows[j], words * 2, table[k + j]);
+				}
+			});
+			for (uint32_t j = 0; j<m && !bError; j++) {
+				bError |= !writer->WriteAt(GetRecoveryOffset(param, j) + first_word * 2, out_rows[j], words * 2);
+			}
+		}
+		for (uint32_t j = 0; j<m && !bError; j++) {
+			const uint8_t* p = highs.get() + (size_t)j*GetBitmapSize(param);
+			table[k + j] = CCrc32::Calc(p, GetBitmapSize(param), table[k + j]);
+			bError |= !writer->WriteAt(GetRecoveryOffset(param, j) + param.ui32BlockSize, p, GetBitmapSize(param));
+		}
+		bool bBreak = Stopped();
+		m_pReporter.reset();
+		if (bError || bBreak) {
+			return false;
+		}
+		return WriteVolumeHeader(*writer, param, table) && writer->Close();
+	}
+
+	// check raw_file against vol_file and write it whole to fix_file with its bad blocks rebuilt
+	// fix_file may be raw_file itself, then only the rebuilt blocks are written and its length set right
+	// bad blocks beyond what the volume can rebuild are reported with ECC_FAILED and left as they were
+	bool RepairFile(
+		const std::string& raw_file,
+		const std::string& vol_file,
+		const std::string& fix_file,
+		VOLUME_CALLBACK_FUNC func = nullptr,
+		uint32_t thread_count = 0/* 0 for the tuned count, all cpu untuned */)
+	{
+		std::unique_ptr<IFileReader> vol_reader(FileIO::OpenReader(vol_file, m_ui32IoBackend, m_ui32IoDepth));
+		if (!vol_reader) {
+			return false;
+		}
+		VOLUME_PARAM param;
+		std::vector<uint32_t> table;
+		if (!ReadVolumeHeader(*vol_reader, param, table)) {
+			return false;
+		}
+		//a raw file that is gone is just every block lost
+		std::unique_ptr<IFileReader> raw_reader(FileIO::OpenReader(raw_file, m_ui32IoBackend, m_ui32IoDepth));
+		if (raw_reader && raw_reader->GetLength() == FileIO::UNKNOWN_LENGTH) {
+			return false;
+		}
+		bool bInPlace = fix_file == raw_file;
+		std::unique_ptr<IFileWriter> fix_writer;
+		if (!bInPlace || !raw_reader) {
+			fix_writer.reset(FileIO::OpenWriter(fix_file));
+			if (!fix_writer) {
+				return false;
+			}
+		}
+
+		StartWorkerPool(thread_count);
+		StartReporter(func, param.ui64FileLength);
+		uint32_t worker_count = m_pPool->GetThreadCount();
+		uint32_t k = param.ui32DataCount;
+		uint32_t m = param.ui32RecoveryCount;
+
+		std::vector<uint8_t> bad;
+		bool bError = !CheckBlocks(raw_reader.get(), *vol_reader, param, table, bInPlace ? nullptr : fix_writer.get(), bad);
+		if (fix_writer) {
+			bError |= !fix_writer->Close();
+			fix_writer.reset();
+		}
+		//cut a longer file and grow a truncated one back to its length
+		if (!bError && !Stopped()) {
+			bError |= !FileIO::TruncateFile(fix_file, param.ui64FileLength);
+		}
+		if (bError || Stopped() || k == 0) {
+			bool bBreak = Stopped();
+			m_pReporter.reset();
+			return !bError && !bBreak;
+		}
+
+		CErasureCoder coder(k, m);
+		std::vector<uint32_t> lost, used;
+		for (uint32_t i = 0; i<k; i++) {
+			if (bad[coder.GetDataPosition(i)]) {
+				lost.push_back(i);
+			}
+		}
+		//as many good recovery blocks as there are lost ones, the others are not read
+		for (uint32_t j = 0; j<m && used.size()<lost.size(); j++) {
+			if (!bad[coder.GetRecoveryPosition(j)]) {
+				used.push_back(j);
+			}
+		}
+		if (lost.empty() || used.size()<lost.size()) {
+			if (m_pReporter) {
+				for (uint32_t i : lost) {
+					m_pReporter->Push((uint64_t)i*param.ui32BlockSize, GetBlockLength(param, i), param.ui64FileLength, IReedSolomonCoder::ECC_FAILED);
+				}
+			}
+			m_pReporter.reset();
+			return true;
+		}
+
+		std::vector<uint32_t> erased;
+		std::vector<bool> is_used(m, false);
+		for (uint32_t i : lost) {
+			erased.push_back(coder.GetDataPosition(i));
+		}
+		for (uint32_t j : used) {
+			is_used[j] = true;
+		}
+		for (uint32_t j = 0; j<m; j++) {
+			if (!is_used[j]) {
+				erased.push_back(coder.GetRecoveryPosition(j));
+			}
+		}
+		coder.SetErasures(erased);
+
+		std::unique_ptr<IFileWriter> updater(FileIO::OpenUpdater(fix_file));
+		if (!updater) {
+			m_pReporter.reset();
+			return false;
+		}
+		uint64_t raw_length = raw_reader ? raw_reader->GetLength() : 0;
+		uint32_t block_words = param.ui32BlockSize / 2;
+		uint32_t known_count = k - (uint32_t)lost.size() + (uint32_t)used.size();
+		uint32_t slice_words = GetSliceWords(param, known_count + (uint32_t)lost.size());
+		CLargeBuffer rows, highs;
+		if (!rows.reset((size_t)(known_count + lost.size())*slice_words * 2) || !highs.reset((size_t)used.size()*slice_words / 8)) {
+			m_pReporter.reset();
+			return false;
+		}
+		std::vector<const uint16_t*> in_rows(coder.K + coder.M, nullptr);
+		std::vector<const uint8_t*> in_highs(coder.K + coder.M, nullptr);
+		std::vector<uint16_t*> out_rows(erased.size(), nullptr);
+		std::vector<uint8_t*> out_highs(erased.size(), nullptr);
+		size_t row = 0;
+		for (uint32_t i = 0; i<k; i++) {
+			if (!bad[coder.GetDataPosition(i)]) {
+				in_rows[coder.GetDataPosition(i)] = (const uint16_t*)rows.get() + row++*slice_words;
+			}
+		}
+		for (size_t u = 0; u<used.size(); u++) {
+			in_rows[coder.GetRecoveryPosition(used[u])] = (const uint16_t*)rows.get() + row++*slice_words;
+			in_highs[coder.GetRecoveryPosition(used[u])] = highs.get() + u*slice_words / 8;
+		}
+		for (size_t e = 0; e<lost.size(); e++) {
+			out_rows[e] = (uint16_t*)rows.get() + row++*slice_words;
+		}
+
+		for (uint32_t first_word = 0; first_word<block_words && !bError && !Stopped(); first_word += slice_words) {
+			uint32_t words = std::min(slice_words, block_words - first_word);
+			for (uint32_t i = 0; i<k && !bError; i++) {
+				uint8_t* p = (uint8_t*)in_rows[coder.GetDataPosition(i)];
+				if (p != nullptr) {
+					bError |= !ReadPadded(raw_reader.get(), raw_length, (uint64_t)i*param.ui32BlockSize + first_word * 2, words * 2, param.ui64FileLength, p);
+				}
+			}
+			for (size_t u = 0; u<used.size() && !bError; u++) {
+				uint32_t p = coder.GetRecoveryPosition(used[u]);
+				uint64_t offset = GetRecoveryOffset(param, used[u]);
+				bError |= !vol_reader->Read(offset + first_word * 2, words * 2, (uint8_t*)in_rows[p]);
+				bError |= !vol_reader->Read(offset + param.ui32BlockSize + first_word / 8, (words + 7) / 8, (uint8_t*)in_highs[p]);
+			}
+			if (bError) {
+				break;
+			}
+			m_pPool->Run(worker_count, [&](uint32_t w) {
+				auto columns = GetWorkerColumns(words, w, worker_count);
+				coder.Rebuild(in_rows.data(), in_highs.data(), out_rows.data(), out_highs.data(), columns.first, columns.second);
+			});
+			for (size_t e = 0; e<lost.size() && !bError; e++) {
+				uint64_t offset = (uint64_t)lost[e] * param.ui32BlockSize + first_word * 2;
+				if (offset<param.ui64FileLength) {
+					uint32_t length = (uint32_t)std::min<uint64_t>(words * 2, param.ui64FileLength - offset);
+					bError |= !updater->WriteAt(offset, out_rows[e], length);
+				}
+			}
+		}
+		bError |= !updater->Close();
+		if (m_pReporter && !bError && !Stopped()) {
+			for (uint32_t i : lost) {
+				m_pReporter->Push((uint64_t)i*param.ui32BlockSize, GetBlockLength(param, i), param.ui64FileLength, IReedSolomonCoder::ECC_SUCCESS);
+			}
+		}
+		bool bBreak = Stopped();
+		m_pReporter.reset();
+		return !bError && !bBreak;
+	}
+};
+
+
+#endif
@@ -7,6 +7,12 @@
 #include <stdarg.h>
 #include <algorithm>
 #include <utility>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <type_traits>
+#include <memory>
+#include <string.h>
 #include "Bit.hpp"
 #include "MemPool.hpp"
 
@@ -77,9 +83,17 @@ namespace ErrorCorrectingCodes
 			return pFMap[Power];
 		}
 	private:
+		//the tables are hit at random, keep them on huge pages, never freed
 		static CGFPrime* GetInstance() {
-			static CGFPrime gf;
-			return &gf;
+			static CGFPrime* gf = new(AllocTables()) CGFPrime;
+			return gf;
+		}
+		static void* AllocTables() {
+			void* p = MemPool::AllocLarge(sizeof(CGFPrime));
+			if (p == nullptr) {
+				throw std::bad_alloc();
+			}
+			return p;
 		}
 		CGFPrime() {
 			m_pFMap[0] = UnitElement();
@@ -108,6 +122,31 @@ namespace ErrorCorrectingCodes
 			MaxM = 1 << FermatOrdinal,
 		};
 
+		typedef typename std::conditional<MaxM <= 8, uint8_t, uint16_t>::type PackedType;
+
+		// MaxN values of MaxM bits each, half the memory of a NumType[] for the 16 bits field
+		// MaxN itself (-1) is the one value that does not fit: it is stored as 0 with its bit set in pHigh,
+		// pHigh is only read for a stored 0 and only written when a 0 is stored, so it is hardly touched
+		struct PACKED_ARRAY {
+			PackedType pValues[MaxN];
+			uint8_t pHigh[MaxN / 8];
+
+			BIT_INLINE NumType Get(uint32_t i)const {
+				uint32_t v = pValues[i];
+				if (v == 0 && ((pHigh[i >> 3] >> (i & 7)) & 1) != 0) {
+					v = MaxN;
+				}
+				return CGFPrime::Num(v);
+			}
+			BIT_INLINE void Set(uint32_t i, NumType x) {
+				pValues[i] = (PackedType)x.uiValue;
+				if (pValues[i] == 0) {
+					uint8_t bit = (uint8_t)(1 << (i & 7));
+					pHigh[i >> 3] = (x.uiValue != 0) ? (pHigh[i >> 3] | bit) : (pHigh[i >> 3] & ~bit);
+				}
+			}
+		};
+
 		static void FNT(NumType Data[], uint32_t Len, bool Reverse = false)
 		{
 			uint32_t N = Len;
@@ -135,6 +174,51 @@ namespace ErrorCorrectingCodes
 				}
 			}
 		}
+		// same transform on packed values
+		// P = 2^MaxM+1, so x = hi*2^MaxM+lo is lo-hi mod P, no division at all
+		static void FNT(PACKED_ARRAY& Data, uint32_t Len, bool Reverse = false)
+		{
+			uint32_t N = Len;
+			uint32_t M = Bit::bit_log2_floor(Len);
+			assert(N == ((uint32_t)1 << M));
+			assert(N <= MaxN);
+
+			const uint32_t P = FermatNumber;
+			for (uint32_t Level = 0; Level<M; Level++) {
+				uint32_t Length = (1 << (M - (Level + 1)));
+				uint32_t Rate = MaxM - M + Level;
+				for (uint32_t Base = 0; Base<N; Base += (Length << 1))
+					for (uint32_t Offset = 0; Offset<Length; Offset++) {
+						uint32_t i = Base + Offset;
+						uint32_t j = i + Length;
+						uint32_t t = Data.Get(i).uiValue;
+						uint32_t u = Data.Get(j).uiValue;
+						//the comparisons are coin flips, masks instead of branches
+						uint32_t sum = t + u;
+						sum -= P & (0u - (uint32_t)(sum >= P));
+						uint32_t diff = t - u;
+						diff += P & (0u - (uint32_t)(t<u));
+						uint64_t prod = (uint64_t)diff*CGFPrime::Exp(Offset << Rate).uiValue;
+						uint32_t lo = (uint32_t)prod & (MaxN - 1);
+						uint32_t hi = (uint32_t)(prod >> MaxM);
+						uint32_t mul = lo - hi;
+						mul += P & (0u - (uint32_t)(lo<hi));
+						Data.Set(i, CGFPrime::Num(sum));
+						Data.Set(j, CGFPrime::Num(mul));
+					}
+			}
+
+			if (Reverse) {
+				for (uint32_t i = 0; i<N; i++) {
+					uint32_t j = Bit::bit_reverse(i) >> (32 - M);
+					if (j>i) {
+						NumType t = Data.Get(i);
+						Data.Set(i, Data.Get(j));
+						Data.Set(j, t);
+					}
+				}
+			}
+		}
 		static void IFNT(NumType Data[], uint32_t Len, bool Reverse = false)
 		{
 			uint32_t N = Len;
@@ -565,13 +649,26 @@ namespace ErrorCorrectingCodes
 		// Decode return: 0 for no error;1 for ecc success;2 for ecc failed
 		virtual ~IReedSolomonCoder() {}
 
+		// precompute the generator, call once before coding and not while coding
+		// the coding calls are const and may then run on any number of threads
+		// CReedSolomonCoderRegistry hands out shared coders that are already initialized
 		virtual		bool Init() = 0;
 
-		virtual		void EncodeT(const void* arrData, void* arrECC) = 0;
-		virtual uint32_t DecodeT(void* arrData, const void* arrECC) = 0;
+		virtual		void EncodeT(const void* arrData, void* arrECC)const = 0;
+		virtual uint32_t DecodeT(void* arrData, const void* arrECC)const = 0;
+
+		virtual		void EncodeF(const void* inArr, void* outArr)const = 0;
+		virtual uint32_t DecodeF(const void* inArr, void* outArr)const = 0;
 
-		virtual		void EncodeF(const void* inArr, void* outArr) = 0;
-		virtual uint32_t DecodeF(const void* inArr, void* outArr) = 0;
+		// same as EncodeT/DecodeT, but the data part is split in chunks of uiChunkLength codewords
+		// placed uiChunkStride bytes apart, so a line can be coded in place inside an interleaved buffer
+		// only the first uiDataCount codewords are stored, the rest of the data part is taken as zero
+		virtual		void EncodeS(const void* arrData, uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, void* arrECC)const = 0;
+		virtual uint32_t DecodeS(void* arrData, uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, const void* arrECC)const = 0;
+
+		// only the syndrome part of DecodeS, true when the line is a codeword and DecodeS would return ECC_NOERROR
+		// one transform where a repair takes several and a key equation, and the same cost for every line
+		virtual		bool CheckS(const void* arrData, uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, const void* arrECC)const = 0;
 	};
 
 	template<typename _CodeWordType>
@@ -658,23 +755,35 @@ namespace ErrorCorrectingCodes
 			M = Q*M;
 		}
 
-		virtual		void EncodeT(const void* arrData, void* arrECC) {
+		virtual		void EncodeT(const void* arrData, void* arrECC)const {
 			EncodeT2((CodeWordType*)arrData, (CodeWordType*)arrECC);
 		}
-		virtual uint32_t DecodeT(void* arrData, const void* arrECC) {
+		virtual uint32_t DecodeT(void* arrData, const void* arrECC)const {
 			return DecodeT2((CodeWordType*)arrData, (CodeWordType*)arrECC);
 		}
-		virtual		void EncodeF(const void* inArr, void* outArr) {
+		virtual		void EncodeF(const void* inArr, void* outArr)const {
 			EncodeF2((CodeWordType*)inArr, (CodeWordType*)outArr);
 		}
-		virtual uint32_t DecodeF(const void* inArr, void* outArr) {
+		virtual uint32_t DecodeF(const void* inArr, void* outArr)const {
 			return DecodeF2((CodeWordType*)inArr, (CodeWordType*)outArr);
 		}
+		virtual		void EncodeS(const void* arrData, uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, void* arrECC)const {
+			EncodeS2((CodeWordType*)arrData, uiDataCount, uiChunkLength, uiChunkStride, (CodeWordType*)arrECC);
+		}
+		virtual uint32_t DecodeS(void* arrData, uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, const void* arrECC)const {
+			return DecodeS2((CodeWordType*)arrData, uiDataCount, uiChunkLength, uiChunkStride, (CodeWordType*)arrECC);
+		}
+		virtual		bool CheckS(const void* arrData, uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, const void* arrECC)const {
+			return CheckS2((const CodeWordType*)arrData, uiDataCount, uiChunkLength, uiChunkStride, (const CodeWordType*)arrECC);
+		}
 	public:
-		virtual		void EncodeT2(const CodeWordType arrData[/*N-(T*2+1)*/], CodeWordType arrECC[/*T*2+1*/]) = 0;
-		virtual uint32_t DecodeT2(CodeWordType arrData[/*N-(T*2+1)*/], const CodeWordType arrECC[/*T*2+1*/]) = 0;
-		virtual		void EncodeF2(const CodeWordType inArr[/*N-(T*2+1)*/], CodeWordType outArr[/*N*/]) = 0;
-		virtual uint32_t DecodeF2(const CodeWordType inArr[/*N*/], CodeWordType outArr[/*N-(T*2+1)*/]) = 0;
+		virtual		void EncodeT2(const CodeWordType arrData[/*N-(T*2+1)*/], CodeWordType arrECC[/*T*2+1*/])const = 0;
+		virtual uint32_t DecodeT2(CodeWordType arrData[/*N-(T*2+1)*/], const CodeWordType arrECC[/*T*2+1*/])const = 0;
+		virtual		void EncodeF2(const CodeWordType inArr[/*N-(T*2+1)*/], CodeWordType outArr[/*N*/])const = 0;
+		virtual uint32_t DecodeF2(const CodeWordType inArr[/*N*/], CodeWordType outArr[/*N-(T*2+1)*/])const = 0;
+		virtual		void EncodeS2(const CodeWordType arrData[], uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, CodeWordType arrECC[/*T*2+1*/])const = 0;
+		virtual uint32_t DecodeS2(CodeWordType arrData[], uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, const CodeWordType arrECC[/*T*2+1*/])const = 0;
+		virtual		bool CheckS2(const CodeWordType arrData[], uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, const CodeWordType arrECC[/*T*2+1*/])const = 0;
 	};
 
 	template<typename _CodeWordType>
@@ -686,6 +795,8 @@ namespace ErrorCorrectingCodes
 		typedef typename IReedSolomonCoder2::CPoly      CPoly;
 		typedef typename IReedSolomonCoder2::CGFPrime   CGFPrime;
 		typedef typename CGFPrime::NumType              NumType;
+		typedef typename IReedSolomonCoder2::CFNT       CFNT;
+		typedef typename CFNT::PACKED_ARRAY             PACKED_ARRAY;
 
 	public:
 		const uint32_t T;
@@ -694,13 +805,18 @@ namespace ErrorCorrectingCodes
 
 		enum :uint32_t {
 			N = IReedSolomonCoder2::N,
+			//a line of at most SHORT_LENGTH codewords, parity included, is a shortened codeword:
+			//encoded by a division by G and checked by a correlation, at a cost that follows its length instead of N
+			SHORT_LENGTH = N / 4,
 		};
 	protected:
 		CPoly G;
 		CPoly EvalQ;
 		CPoly EvalQ_;
+		CPoly RevGInv;//1/Rev(G) mod x^(SHORT_LENGTH-T2)
+		CPoly EvalChirp;//[m]->[2m-1] is the transform of w^(k(k-1)/2),k<m, for every m=2^i up to SHORT_LENGTH
 
-		void Euclidean(const CPoly& S/*[T2]*/, CPoly& Lambda/*[T+1]*/, CPoly& Omega/*[T]*/)
+		void Euclidean(const CPoly& S/*[T2]*/, CPoly& Lambda/*[T+1]*/, CPoly& Omega/*[T]*/)const
 		{
 			CMatrix<2, 1, CPoly> R;
 			R[0][0] = (CPoly::UnitElement() << T2);
@@ -712,6 +828,112 @@ namespace ErrorCorrectingCodes
 			Omega = std::move(R[1][0]);
 		}
 
+		static CodeWordType* DataAt(CodeWordType arrData[], uint32_t uiIndex, uint32_t uiChunkLength, size_t uiChunkStride)
+		{
+			return (CodeWordType*)((uint8_t*)arrData + (uiIndex / uiChunkLength)*uiChunkStride) + uiIndex%uiChunkLength;
+		}
+
+		//M[T2+1]->M[N-1] from the chunked data, zero after uiDataCount
+		void LoadData(CPoly& M, const CodeWordType arrData[], uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride)const
+		{
+			assert(uiDataCount <= K);
+			uint32_t k = 0;
+			for (const uint8_t* pChunk = (const uint8_t*)arrData; k<uiDataCount; pChunk += uiChunkStride) {
+				const CodeWordType* p = (const CodeWordType*)pChunk;
+				uint32_t n = std::min(uiChunkLength, uiDataCount - k);
+				for (uint32_t i = 0; i<n; i++) {
+					M[k + i + T2 + 1] = CGFPrime::Num(p[i]);
+				}
+				k += n;
+			}
+			for (; k<K; k++) {
+				M[k + T2 + 1] = CGFPrime::ZeroElement();
+			}
+		}
+
+		bool IsShort(uint32_t uiDataCount)const
+		{
+			return T2 + 1 + uiDataCount <= SHORT_LENGTH;
+		}
+
+		static NumType Chirp(uint32_t k)//w^(k(k-1)/2)
+		{
+			return CGFPrime::Exp((uint32_t)((uint64_t)k*(k - 1) / 2 % N));
+		}
+
+		//Q*G mod x^T2 for the quotient Q of M/G, M[T2] is uiTop and M[T2+1]->M[T2+uiDataCount] the chunked data
+		//Rev(Q)=Rev(M)*Rev(G)^-1 mod x^(uiDataCount+1), so only the data part of M is needed,
+		//and M mod G is M[0]->M[T2-1] minus the result
+		CPoly ShortQG(const CodeWordType arrData[], uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, CodeWordType uiTop)const
+		{
+			assert(IsShort(uiDataCount));
+			CPoly RevM;
+			RevM.m_uiDegree = uiDataCount;
+			RevM[uiDataCount] = CGFPrime::Num(uiTop);
+			uint32_t k = 0;
+			for (const uint8_t* pChunk = (const uint8_t*)arrData; k<uiDataCount; pChunk += uiChunkStride) {
+				const CodeWordType* p = (const CodeWordType*)pChunk;
+				uint32_t n = std::min(uiChunkLength, uiDataCount - k);
+				for (uint32_t i = 0; i<n; i++) {
+					RevM[uiDataCount - 1 - (k + i)] = CGFPrime::Num(p[i]);
+				}
+				k += n;
+			}
+			RevM.Modify();
+			CPoly RevQ = CPoly::ModX(RevM*CPoly::ModX(RevGInv, uiDataCount + 1), uiDataCount + 1);
+			CPoly Q;
+			Q.m_uiDegree = uiDataCount;
+			for (uint32_t i = 0; i <= uiDataCount; i++) {
+				Q[i] = RevQ[uiDataCount - i];
+			}
+			Q.Modify();
+			return CPoly::ModX(Q*G, T2);
+		}
+
+		//the parity is M+ModifyNum*G, ModifyNum is the smallest value keeping all of it below N
+		NumType GetModifyNum(const CPoly& M)const
+		{
+			std::vector<uint32_t> vUsed(T2 + 1);
+			for (uint32_t i = 0; i <= T2; i++) {
+				vUsed[i] = ((CGFPrime::Num(N) - M[i]) / G[i]).uiValue;
+			}
+			std::sort(vUsed.begin(), vUsed.end());
+			uint32_t uiModifyNum = 0;
+			for (uint32_t i = 0; i <= T2 && vUsed[i] <= uiModifyNum; i++) {
+				if (vUsed[i] == uiModifyNum) uiModifyNum++;
+			}
+			return CGFPrime::Num(uiModifyNum);
+		}
+
+		//one per thread, like the polynomial pools
+		static PACKED_ARRAY& GetPackedArray()
+		{
+			thread_local static std::unique_ptr<PACKED_ARRAY> pArray(new PACKED_ARRAY);
+			return *pArray;
+		}
+
+		//LoadData for a packed M, arrECC nullptr for a zero M[0]->M[T2]
+		//a codeword always fits, the stored zeros are all real zeros
+		void LoadPacked(PACKED_ARRAY& M, const CodeWordType arrData[], uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, const CodeWordType arrECC[/*T*2+1*/])const
+		{
+			static_assert(sizeof(typename CFNT::PackedType) == sizeof(CodeWordType), "packed values do not match the codewords!");
+			assert(uiDataCount <= K);
+			memset(M.pHigh, 0, sizeof(M.pHigh));
+			if (arrECC != nullptr) {
+				memcpy(M.pValues, arrECC, (T2 + 1)*sizeof(CodeWordType));
+			}
+			else {
+				memset(M.pValues, 0, (T2 + 1)*sizeof(CodeWordType));
+			}
+			uint32_t k = 0;
+			for (const uint8_t* pChunk = (const uint8_t*)arrData; k<uiDataCount; pChunk += uiChunkStride) {
+				uint32_t n = std::min(uiChunkLength, uiDataCount - k);
+				memcpy(&M.pValues[k + T2 + 1], pChunk, n*sizeof(CodeWordType));
+				k += n;
+			}
+			memset(&M.pValues[k + T2 + 1], 0, (K - k)*sizeof(CodeWordType));
+		}
+
 		virtual bool Init()
 		{
 			if (G.m_uiDegree == 0)
@@ -748,6 +970,27 @@ namespace ErrorCorrectingCodes
 				EvalQ = this->Eval(Q);
 				EvalQ_ = this->Eval(CPoly::Der(Q));
 			}
+			if (RevGInv.m_uiDegree == 0 && T2<SHORT_LENGTH)
+			{
+				//Rev(x^(SHORT_LENGTH-1)/G) is 1/Rev(G) to as many terms as the quotient has
+				CPoly Q = (CPoly::UnitElement() << (SHORT_LENGTH - 1)) / G;
+				RevGInv.m_uiDegree = Q.m_uiDegree;
+				for (uint32_t i = 0; i <= Q.m_uiDegree; i++) {
+					RevGInv[i] = Q[Q.m_uiDegree - i];
+				}
+				RevGInv.Modify();
+			}
+			if (EvalChirp.m_uiDegree == 0)
+			{
+				EvalChirp.m_uiDegree = SHORT_LENGTH * 2 - 1;
+				EvalChirp[0] = CGFPrime::ZeroElement();
+				for (uint32_t m = 1; m <= SHORT_LENGTH; m *= 2) {
+					for (uint32_t k = 0; k<m; k++) {
+						EvalChirp[m + k] = Chirp(k);
+					}
+					CFNT::FNT(&EvalChirp.m_pCoeffs[m], m);
+				}
+			}
 
 			return true;
 		}
@@ -758,20 +1001,42 @@ namespace ErrorCorrectingCodes
 			assert(N>T2 + 1);
 		}
 
-		virtual void EncodeT2(const CodeWordType arrData[/*N-(T*2+1)*/], CodeWordType arrECC[/*T*2+1*/])
+		virtual void EncodeT2(const CodeWordType arrData[/*N-(T*2+1)*/], CodeWordType arrECC[/*T*2+1*/])const
 		{
-			Init();
+			EncodeS2(arrData, K, K, 0, arrECC);
+		}
 
-			CPoly M;
-			M.m_uiDegree = N - 1;
-			for (uint32_t i = 0; i <= T2; i++) {
-				M[i] = CGFPrime::ZeroElement();
-			}
-			for (uint32_t i = 0; i<K; i++) {
-				M[i + T2 + 1].uiValue = arrData[i];
+		virtual uint32_t DecodeT2(CodeWordType arrData[/*N-(T*2+1)*/], const CodeWordType arrECC[/*T*2+1*/])const
+		{
+			return DecodeS2(arrData, K, K, 0, arrECC);
+		}
+
+		virtual void EncodeS2(const CodeWordType arrData[], uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, CodeWordType arrECC[/*T*2+1*/])const
+		{
+			assert(G.m_uiDegree != 0);//Init() first
+
+			if (IsShort(uiDataCount)) {
+				//-R=Q*G mod x^T2, M[0]->M[T2] being 0
+				CPoly M = ShortQG(arrData, uiDataCount, uiChunkLength, uiChunkStride, 0);
+				NumType ModifyNum = GetModifyNum(M);
+				for (uint32_t i = 0; i <= T2; i++) {
+					arrECC[i] = (M[i] + ModifyNum*G[i]).uiValue;
+				}
+				return;
 			}
 
-			CPoly EvalR = this->Eval(M);
+			//M[0]->M[T2] are 0, the transform of M is done on packed values
+			//and left in bit reversed order, only EvalM:[1]->[T2] is needed from it
+			PACKED_ARRAY& EvalM = GetPackedArray();
+			LoadPacked(EvalM, arrData, uiDataCount, uiChunkLength, uiChunkStride, nullptr);
+			CFNT::FNT(EvalM, N, false);
+
+			CPoly EvalR;
+			EvalR.m_uiDegree = N - 1;
+			uint32_t Shift = 32 - Bit::bit_log2_floor(N);
+			for (uint32_t i = 1; i <= T2; i++) {
+				EvalR[i] = EvalM.Get(Bit::bit_reverse(i) >> Shift);
+			}
 			//G|(M-R),so EvalM_R:[1]->[T2] is 0,then EvalR:[1]->[T2] equal EvalM:[1]->[T2]
 			//deg(R)=deg(G)-1=T2-1,so [1]->[T2] calc R is enough
 			//let Q=(x-1)Mul{i=T2+1->N-1}(x-w^i)
@@ -790,38 +1055,90 @@ namespace ErrorCorrectingCodes
 			EvalR[0] = EvalQR_[0] / EvalQ_[0];
 			for (uint32_t i = T2 + 1; i<N; i++) EvalR[i] = EvalQR_[i] / EvalQ_[i];
 			CPoly R = this->Inter(EvalR);//R=QR/Q;
-			M.m_uiDegree = T2;
-			M = M - R;
-			uint32_t Count[N + 1] = { 0 };
-			for (uint32_t i = 0; i <= T2; i++) {
-				Count[((CGFPrime::Num(N) - M[i]) / G[i]).uiValue]++;
-			}
-			NumType ModifyNum = CGFPrime::ZeroElement();
-			for (uint32_t i = 0; i<N; i++) {
-				if (Count[i] == 0) { ModifyNum = CGFPrime::Num(i); break; }
-			}
+			CPoly M = CPoly() - R;
+			NumType ModifyNum = GetModifyNum(M);
 			for (uint32_t i = 0; i <= T2; i++) {
 				arrECC[i] = (M[i] + ModifyNum*G[i]).uiValue;
 			}
 		}
 
-		virtual uint32_t DecodeT2(CodeWordType arrData[/*N-(T*2+1)*/], const CodeWordType arrECC[/*T*2+1*/])
+		//M from the received line, EvalM[1]->EvalM[T2] is then its syndrome
+		//return true when the syndrome is zero
+		bool Syndrome(CPoly& M, CPoly& EvalM, const CodeWordType arrData[], uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, const CodeWordType arrECC[/*T*2+1*/])const
 		{
-			CPoly M;
 			M.m_uiDegree = N - 1;
 			for (uint32_t i = 0; i <= T2; i++) {
 				M[i] = CGFPrime::Num(arrECC[i]);
 			}
-			for (uint32_t i = 0; i<K; i++) {
-				M[i + T2 + 1] = CGFPrime::Num(arrData[i]);
-			}
-			CPoly EvalM = this->Eval(M);
-			//////////////////////////////////////////////////////////////////////////
+			LoadData(M, arrData, uiDataCount, uiChunkLength, uiChunkStride);
+			EvalM = this->Eval(M);
 			uint32_t uiRet = 0;
 			for (uint32_t i = 1; i <= T2 && uiRet == 0; i++) {
 				uiRet |= EvalM[i].uiValue;
 			}
-			if (uiRet == 0) {
+			return uiRet == 0;
+		}
+
+		//Syndrome on packed values, nothing of the line is kept for a repair
+		//a short line of L codewords takes a correlation of length L+T2 instead:
+		//ij=C(i+j,2)-C(i,2)-C(j,2), so EvalM[i]=w^-C(i,2)*Sum{j}(M[j]*w^-C(j,2))*w^C(i+j,2)
+		virtual bool CheckS2(const CodeWordType arrData[], uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, const CodeWordType arrECC[/*T*2+1*/])const
+		{
+			if (IsShort(uiDataCount + T2)) {
+				uint32_t L = T2 + 1 + uiDataCount;
+				uint32_t m = 1 << Bit::bit_log2_ceil(L + T2);
+				//A[L-1-j]=M[j]*w^-C(j,2),then (A*Chirp)[L-1+i] is EvalM[i]*w^C(i,2)
+				CPoly A;
+				A.m_uiDegree = m - 1;
+				NumType* pA = A.m_pCoeffs;
+				for (uint32_t j = 0; j <= T2; j++) {
+					pA[L - 1 - j] = CGFPrime::Num(arrECC[j]) / Chirp(j);
+				}
+				uint32_t k = 0;
+				for (const uint8_t* pChunk = (const uint8_t*)arrData; k<uiDataCount; pChunk += uiChunkStride) {
+					const CodeWordType* p = (const CodeWordType*)pChunk;
+					uint32_t n = std::min(uiChunkLength, uiDataCount - k);
+					for (uint32_t i = 0; i<n; i++) {
+						uint32_t j = k + i + T2 + 1;
+						pA[L - 1 - j] = CGFPrime::Num(p[i]) / Chirp(j);
+					}
+					k += n;
+				}
+				for (uint32_t i = L; i<m; i++) {
+					pA[i] = CGFPrime::ZeroElement();
+				}
+				CFNT::FNT(pA, m);
+				for (uint32_t i = 0; i<m; i++) {
+					pA[i] = pA[i] * EvalChirp[m + i];
+				}
+				CFNT::IFNT(pA, m);
+				for (uint32_t i = 1; i <= T2; i++) {
+					if (pA[L - 1 + i] != CGFPrime::ZeroElement()) {
+						return false;
+					}
+				}
+				return true;
+			}
+
+			PACKED_ARRAY& EvalM = GetPackedArray();
+			LoadPacked(EvalM, arrData, uiDataCount, uiChunkLength, uiChunkStride, arrECC);
+			//left in bit reversed order, only T2 values are looked at
+			CFNT::FNT(EvalM, N, false);
+			uint32_t Shift = 32 - Bit::bit_log2_floor(N);
+			for (uint32_t i = 1; i <= T2; i++) {
+				if (EvalM.Get(Bit::bit_reverse(i) >> Shift) != CGFPrime::ZeroElement()) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		virtual uint32_t DecodeS2(CodeWordType arrData[], uint32_t uiDataCount, uint32_t uiChunkLength, size_t uiChunkStride, const CodeWordType arrECC[/*T*2+1*/])const
+		{
+			CPoly M;
+			CPoly EvalM;
+			//////////////////////////////////////////////////////////////////////////
+			if (Syndrome(M, EvalM, arrData, uiDataCount, uiChunkLength, uiChunkStride, arrECC)) {
 				return IReedSolomonCoder::ECC_NOERROR;
 			}
 			//////////////////////////////////////////////////////////////////////////
@@ -838,8 +1155,8 @@ namespace ErrorCorrectingCodes
 				if (EvalLambda[i] == CGFPrime::ZeroElement()) {
 					uint32_t j = (N - i) % N;
 					M[j] = M[j] + EvalOmega[i] / EvalLambda_[i];
-					if (j>T2) {
-						arrData[j - T2 - 1] = M[j].uiValue;
+					if (j>T2 && j - T2 - 1<uiDataCount) {
+						*DataAt(arrData, j - T2 - 1, uiChunkLength, uiChunkStride) = M[j].uiValue;
 					}
 				}
 			}
@@ -854,7 +1171,7 @@ namespace ErrorCorrectingCodes
 			return IReedSolomonCoder::ECC_SUCCESS;
 		}
 
-		virtual void EncodeF2(const CodeWordType inArr[/*N-(T*2+1)*/], CodeWordType outArr[/*N*/])
+		virtual void EncodeF2(const CodeWordType inArr[/*N-(T*2+1)*/], CodeWordType outArr[/*N*/])const
 		{
 			CPoly EvalM;
 			EvalM.m_uiDegree = N - 1;
@@ -879,7 +1196,7 @@ namespace ErrorCorrectingCodes
 			}
 		}
 
-		virtual uint32_t DecodeF2(const CodeWordType inArr[/*N*/], CodeWordType outArr[/*N-(T*2+1)*/])
+		virtual uint32_t DecodeF2(const CodeWordType inArr[/*N*/], CodeWordType outArr[/*N-(T*2+1)*/])const
 		{
 			CPoly M;
 			M.m_uiDegree = N - 1;
@@ -926,6 +1243,29 @@ namespace ErrorCorrectingCodes
 		}
 	};
 
+	// one shared, initialized coder per (coder type, T) for the whole process
+	// the coders are never destroyed: their polynomials come from the thread_local pool of
+	// the thread that built them, which may be gone by the time static objects are destroyed
+	template<typename _CodeWordType, typename _Coder = CReedSolomonCoder<_CodeWordType>>
+	class CReedSolomonCoderRegistry
+	{
+	public:
+		typedef _Coder CCoder;
+
+		static const CCoder* Get(uint32_t uiT) {
+			static std::mutex lock;
+			static std::map<uint32_t, CCoder*> coders;
+
+			std::lock_guard<std::mutex> guard(lock);
+			CCoder*& pCoder = coders[uiT];
+			if (pCoder == nullptr) {
+				pCoder = new CCoder(uiT);
+				static_cast<IReedSolomonCoder*>(pCoder)->Init();
+			}
+			return pCoder;
+		}
+	};
+
 };
 
 
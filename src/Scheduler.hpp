@@ -0,0 +1,105 @@
+#pragma once
+
+#ifndef _SCHEDULER_HPP_
+#define _SCHEDULER_HPP_
+
+#include <assert.h>
+#include <stdint.h>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+
+
+namespace Scheduler
+{
+
+	// hands out [begin,end) line batches to a fixed set of workers
+	// every worker starts with an even share and pops small batches from its front,
+	// an idle worker steals the back half of the next worker after it, in ring order, that has work left,
+	// so a run of damaged lines (expensive to repair) does not stay on one core
+	class CWorkStealingScheduler
+	{
+	public:
+		enum :uint32_t {
+			DEFAULT_BATCH_SIZE = 2,
+			CACHE_LINE_SIZE = 64,
+		};
+	protected:
+		struct WORKER_RANGE {
+			std::mutex lock;
+			uint32_t uiBegin;
+			uint32_t uiEnd;
+			uint8_t pPadding[CACHE_LINE_SIZE];//keep neighbour ranges off the same cache line
+		};
+
+		std::unique_ptr<WORKER_RANGE[]> m_pRanges;
+		uint32_t m_uiWorkerCount;
+		uint32_t m_uiBatchSize;
+
+		bool TakeBatch(WORKER_RANGE& range, uint32_t& uiBegin, uint32_t& uiEnd) {
+			if (range.uiBegin >= range.uiEnd) {
+				return false;
+			}
+			uiBegin = range.uiBegin;
+			uiEnd = std::min(range.uiEnd, range.uiBegin + m_uiBatchSize);
+			range.uiBegin = uiEnd;
+			return true;
+		}
+	public:
+		CWorkStealingScheduler(uint32_t uiWorkerCount, uint32_t uiBatchSize = DEFAULT_BATCH_SIZE)
+			:m_pRanges(new WORKER_RANGE[uiWorkerCount]), m_uiWorkerCount(uiWorkerCount), m_uiBatchSize(uiBatchSize) {
+			assert(uiWorkerCount>0);
+			assert(uiBatchSize>0);
+			for (uint32_t i = 0; i<m_uiWorkerCount; i++) {
+				m_pRanges[i].uiBegin = m_pRanges[i].uiEnd = 0;
+			}
+		}
+
+		uint32_t GetWorkerCount()const { return m_uiWorkerCount; }
+
+		// not thread safe, call before the workers start
+		void Reset(uint32_t uiBegin, uint32_t uiEnd) {
+			assert(uiBegin <= uiEnd);
+			uint64_t uiLength = uiEnd - uiBegin;
+			for (uint32_t i = 0; i<m_uiWorkerCount; i++) {
+				m_pRanges[i].uiBegin = uiBegin + (uint32_t)(uiLength*i / m_uiWorkerCount);
+				m_pRanges[i].uiEnd = uiBegin + (uint32_t)(uiLength*(i + 1) / m_uiWorkerCount);
+			}
+		}
+
+		// return false when no work is left anywhere
+		bool Next(uint32_t uiWorker, uint32_t& uiBegin, uint32_t& uiEnd) {
+			assert(uiWorker<m_uiWorkerCount);
+			WORKER_RANGE& own = m_pRanges[uiWorker];
+			{
+				std::lock_guard<std::mutex> guard(own.lock);
+				if (TakeBatch(own, uiBegin, uiEnd)) {
+					return true;
+				}
+			}
+
+			for (uint32_t k = 1; k<m_uiWorkerCount; k++) {
+				WORKER_RANGE& victim = m_pRanges[(uiWorker + k) % m_uiWorkerCount];
+				uint32_t uiStealBegin, uiStealEnd;
+				{
+					std::lock_guard<std::mutex> guard(victim.lock);
+					if (victim.uiBegin >= victim.uiEnd) {
+						continue;
+					}
+					uint32_t uiRemain = victim.uiEnd - victim.uiBegin;
+					uiStealEnd = victim.uiEnd;
+					uiStealBegin = victim.uiEnd - (uiRemain + 1) / 2;
+					victim.uiEnd = uiStealBegin;
+				}
+				std::lock_guard<std::mutex> guard(own.lock);
+				own.uiBegin = uiStealBegin;
+				own.uiEnd = uiStealEnd;
+				return TakeBatch(own, uiBegin, uiEnd);
+			}
+			return false;
+		}
+	};
+};
+
+
+#endif
@@ -0,0 +1,119 @@
+#pragma once
+
+#ifndef _THREADPOOL_HPP_
+#define _THREADPOOL_HPP_
+
+#include <assert.h>
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "Numa.hpp"
+
+
+namespace ThreadPool
+{
+
+	// a fixed set of threads kept alive between rounds of work
+	// the coders keep thread_local polynomial pools, reusing the threads keeps them warm
+	// several coders may share one pool, their rounds take turns in the order they were asked for
+	class CWorkerPool
+	{
+	public:
+		typedef std::function<void(uint32_t)> JOB_FUNC;
+	protected:
+		std::vector<std::thread> m_vThreads;
+		std::vector<uint32_t> m_vCpus;	//cpu of each worker, empty when not pinned
+		std::mutex m_lock;
+		std::condition_variable m_cvStart;
+		std::condition_variable m_cvDone;
+
+		const JOB_FUNC* m_pJob;
+		uint32_t m_uiActive;	//workers [0,m_uiActive) take part in this round
+		uint32_t m_uiPending;	//workers of this round still running
+		uint64_t m_ui64Round;
+		uint64_t m_ui64NextTicket;	//rounds asked for so far
+		uint64_t m_ui64Serving;		//ticket of the round running or next to run
+		bool m_bStop;
+
+		void WorkerLoop(uint32_t uiWorker) {
+			//before anything thread_local is touched, so it is allocated on the worker's node
+			if (uiWorker<m_vCpus.size()) {
+				Numa::PinThread(m_vCpus[uiWorker]);
+			}
+			uint64_t ui64Seen = 0;
+			for (;;) {
+				const JOB_FUNC* pJob = nullptr;
+				{
+					std::unique_lock<std::mutex> guard(m_lock);
+					m_cvStart.wait(guard, [&] { return m_bStop || m_ui64Round != ui64Seen; });
+					if (m_bStop) {
+						return;
+					}
+					ui64Seen = m_ui64Round;
+					if (uiWorker >= m_uiActive) {
+						continue;
+					}
+					pJob = m_pJob;
+				}
+				(*pJob)(uiWorker);
+				{
+					std::lock_guard<std::mutex> guard(m_lock);
+					if (--m_uiPending == 0) {
+						m_cvDone.notify_all();
+					}
+				}
+			}
+		}
+	public:
+		// vCpus pins worker i to vCpus[i], leave it empty to let the system place them
+		CWorkerPool(uint32_t uiThreadCount, const std::vector<uint32_t>& vCpus = std::vector<uint32_t>())
+			:m_vCpus(vCpus), m_pJob(nullptr), m_uiActive(0), m_uiPending(0), m_ui64Round(0), m_ui64NextTicket(0), m_ui64Serving(0), m_bStop(false) {
+			assert(uiThreadCount>0);
+			assert(vCpus.empty() || vCpus.size() == uiThreadCount);
+			for (uint32_t i = 0; i<uiThreadCount; i++) {
+				m_vThreads.push_back(std::thread(&CWorkerPool::WorkerLoop, this, i));
+			}
+		}
+		~CWorkerPool() {
+			{
+				std::lock_guard<std::mutex> guard(m_lock);
+				m_bStop = true;
+			}
+			m_cvStart.notify_all();
+			for (auto& t : m_vThreads) {
+				t.join();
+			}
+		}
+
+		uint32_t GetThreadCount()const { return (uint32_t)m_vThreads.size(); }
+
+		// run job(worker) for worker in [0,uiCount) and wait until all of them return
+		// callers on other threads wait for the rounds asked for before theirs, first come first served,
+		// so a long run of rounds from one caller holds up another one by a round at most
+		// not reentrant, a job must not call Run
+		void Run(uint32_t uiCount, const JOB_FUNC& job) {
+			assert(uiCount <= m_vThreads.size());
+			if (uiCount == 0) {
+				return;
+			}
+			std::unique_lock<std::mutex> guard(m_lock);
+			uint64_t ui64Ticket = m_ui64NextTicket++;
+			m_cvDone.wait(guard, [&] { return m_ui64Serving == ui64Ticket; });
+			m_pJob = &job;
+			m_uiActive = uiCount;
+			m_uiPending = uiCount;
+			m_ui64Round++;
+			m_cvStart.notify_all();
+			m_cvDone.wait(guard, [&] { return m_uiPending == 0; });
+			m_pJob = nullptr;
+			m_ui64Serving++;
+			m_cvDone.notify_all();
+		}
+	};
+};
+
+
+#endif
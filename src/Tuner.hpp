@@ -0,0 +1,196 @@
+#pragma once
+
+#ifndef _TUNER_HPP_
+#define _TUNER_HPP_
+
+#include "BufferCoder.hpp"
+#include "Tuning.hpp"
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+// measures the settings of Tuning::PROFILE on this machine
+// coding is timed on data in memory, encode and check, so only the cores and caches count,
+// the io depth on a file written to io_dir and read back through the uring backend, so only the device counts
+// each setting is tried with the ones chosen before it: threads, then intertwine, then io depth
+class CEccTuner
+{
+public:
+	typedef Tuning::PROFILE PROFILE;
+
+	// once per candidate, value of setting "threads", "intertwine_mb" or "io_depth" and its speed
+	typedef void(__stdcall *TUNER_CALLBACK_FUNC)(const char* setting, uint32_t value, double mb_per_second);
+
+	enum :uint32_t {
+		DEFAULT_SAMPLE_MB = 64,		//data coded for each candidate
+		DEFAULT_IO_SAMPLE_MB = 256,	//file read for each io depth
+		SAMPLE_PERCENT = 5,
+		SAME_SPEED_PERCENT = 5,		//a candidate this close to the fastest counts as fast, the smaller one wins
+		IO_READ_SIZE = 8 << 20,
+		MAX_IO_DEPTH = 64,
+		MIN_INTERTWINE_MB = 4,
+		MAX_INTERTWINE_MB = 256,
+	};
+protected:
+	typedef std::pair<uint32_t, double> CANDIDATE;	//value, MB/s
+
+	uint32_t m_ui32SampleMB;
+	uint32_t m_ui32IoSampleMB;
+	TUNER_CALLBACK_FUNC m_pFunc;
+	std::vector<uint8_t> m_vSample;
+
+	static double GetSeconds(std::chrono::steady_clock::time_point begin) {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	}
+
+	//0 if the sample could not be coded
+	double MeasureCoding(uint32_t thread_count, uint32_t intertwine_mb) {
+		CEccBufferCoder::ECC_PARAM param;
+		if (!CEccBufferCoder::CreateEccParam(param, SAMPLE_PERCENT, 16, intertwine_mb)) {
+			return 0;
+		}
+		std::vector<uint8_t> parity((size_t)CEccBufferCoder::GetParityLength(param, m_vSample.size()));
+		CEccBufferCoder coder;
+		auto begin = std::chrono::steady_clock::now();
+		uint32_t result;
+		if (!coder.EncodeBuffer(m_vSample.data(), m_vSample.size(), parity.data(), parity.size(), param, nullptr, thread_count) ||
+			!coder.CheckBuffer(m_vSample.data(), m_vSample.size(), parity.data(), parity.size(), param, result, nullptr, thread_count) ||
+			result != ErrorCorrectingCodes::IReedSolomonCoder::ECC_NOERROR) {
+			return 0;
+		}
+		return 2.0*m_vSample.size() / (1 << 20) / GetSeconds(begin);
+	}
+
+	//0 if the file can not be read through the uring backend
+	double MeasureReading(const std::string& file, uint32_t io_depth) {
+#if FILEIO_HAS_URING
+		FileIO::CUringReader reader(io_depth);
+		if (!reader.Open(file)) {
+			return 0;
+		}
+		std::unique_ptr<uint8_t[]> buff(new uint8_t[IO_READ_SIZE]);
+		uint64_t length = reader.GetLength();
+		auto begin = std::chrono::steady_clock::now();
+		for (uint64_t offset = 0; offset<length; offset += IO_READ_SIZE) {
+			if (!reader.Read(offset, (uint32_t)std::min<uint64_t>(IO_READ_SIZE, length - offset), buff.get())) {
+				return 0;
+			}
+		}
+		return (double)length / (1 << 20) / GetSeconds(begin);
+#else
+		return 0;
+#endif
+	}
+
+	void Report(const char* setting, const CANDIDATE& candidate) {
+		if (m_pFunc != nullptr) {
+			m_pFunc(setting, candidate.first, candidate.second);
+		}
+	}
+
+	//the smallest value within SAME_SPEED_PERCENT of the fastest, 0 if none was measured
+	static uint32_t Choose(const std::vector<CANDIDATE>& candidates) {
+		double best = 0;
+		for (auto& candidate : candidates) {
+			best = std::max(best, candidate.second);
+		}
+		uint32_t value = 0;
+		for (auto& candidate : candidates) {
+			if (candidate.second>0 && candidate.second*100 >= best*(100 - SAME_SPEED_PERCENT) && (value == 0 || candidate.first<value)) {
+				value = candidate.first;
+			}
+		}
+		return value;
+	}
+
+	bool WriteIoSample(const std::string& file) {
+		std::unique_ptr<FileIO::IFileWriter> writer(FileIO::OpenWriter(file));
+		if (!writer) {
+			return false;
+		}
+		for (uint64_t length = 0; length<((uint64_t)m_ui32IoSampleMB << 20); length += m_vSample.size()) {
+			if (!writer->Write(m_vSample.data(), (uint32_t)m_vSample.size())) {
+				return false;
+			}
+		}
+		return writer->Close();
+	}
+public:
+	CEccTuner(
+		uint32_t sample_mb = DEFAULT_SAMPLE_MB,
+		uint32_t io_sample_mb = DEFAULT_IO_SAMPLE_MB,
+		TUNER_CALLBACK_FUNC func = nullptr)
+		:m_ui32SampleMB(std::max(sample_mb, 1u)), m_ui32IoSampleMB(std::max(io_sample_mb, 1u)), m_pFunc(func) {
+	}
+
+	// measure this machine, profile gets the settings found, the defaults for what could not be measured
+	// io_dir is where the io sample file goes, on the device to be used, "" to leave the io depth
+	bool Tune(PROFILE& profile, const std::string& io_dir = "") {
+		profile = Tuning::GetDefaultProfile();
+		m_vSample.resize((size_t)m_ui32SampleMB << 20);
+		uint32_t seed = 1;
+		for (auto& x : m_vSample) {
+			seed = seed * 1103515245 + 12345;
+			x = (uint8_t)(seed >> 16);
+		}
+
+		//the coder is built on first use, not while a candidate is timed
+		if (MeasureCoding(1, Tuning::DEFAULT_INTERTWINE_MB) == 0) {
+			return false;
+		}
+
+		//all cpus, then halves of them: a shared core or memory bandwidth may give no more with more threads
+		std::vector<CANDIDATE> threads;
+		for (uint32_t n = Tuning::GetCpuCount(); n>0; n /= 2) {
+			threads.push_back(CANDIDATE(n, MeasureCoding(n, Tuning::DEFAULT_INTERTWINE_MB)));
+			Report("threads", threads.back());
+		}
+		uint32_t thread_count = Choose(threads);
+		if (thread_count == 0) {
+			return false;
+		}
+		profile.ui32ThreadCount = thread_count == Tuning::GetCpuCount() ? 0 : thread_count;
+
+		//a round holds two stripes, the sample has room for two at least
+		std::vector<CANDIDATE> intertwines;
+		for (uint32_t mb = MIN_INTERTWINE_MB; mb <= MAX_INTERTWINE_MB && mb * 2 <= m_ui32SampleMB; mb *= 2) {
+			intertwines.push_back(CANDIDATE(mb, MeasureCoding(thread_count, mb)));
+			Report("intertwine_mb", intertwines.back());
+		}
+		if (Choose(intertwines) != 0) {
+			profile.ui32IntertwineMB = Choose(intertwines);
+		}
+
+		if (!io_dir.empty()) {
+			std::string file = io_dir + "/.ecc_tuner.tmp";
+			bool written = WriteIoSample(file);
+			std::vector<CANDIDATE> depths;
+			for (uint32_t depth = 1; written && depth <= MAX_IO_DEPTH; depth *= 2) {
+				depths.push_back(CANDIDATE(depth, MeasureReading(file, depth)));
+				Report("io_depth", depths.back());
+			}
+			remove(file.c_str());
+			if (!written) {
+				return false;
+			}
+			if (Choose(depths) != 0) {
+				profile.ui32IoDepth = Choose(depths);
+			}
+		}
+		m_vSample.clear();
+		m_vSample.shrink_to_fit();
+		return true;
+	}
+
+	// Tune and save the profile where the coders look for it, Tuning::GetProfilePath
+	// the process that tuned still runs with the profile it loaded at its start
+	bool TuneAndSave(PROFILE& profile, const std::string& io_dir = "") {
+		return Tune(profile, io_dir) && Tuning::SaveProfile(Tuning::GetProfilePath(), profile);
+	}
+};
+
+
+#endif
@@ -0,0 +1,127 @@
+#pragma once
+
+#ifndef _TUNING_HPP_
+#define _TUNING_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include "FileIO.hpp"
+
+// the settings CEccTuner measured on this machine, kept in a small text file:
+// $ECC_PROFILE, else .ecc_profile in the home directory
+// the coders take them whenever the caller leaves the setting at 0
+namespace Tuning
+{
+
+	enum :uint32_t {
+		DEFAULT_INTERTWINE_MB = 32,
+	};
+
+	struct PROFILE {
+		uint32_t ui32CpuCount;		//cpus of the machine it was measured on, a profile of other hardware is not used
+		uint32_t ui32IntertwineMB;	//stripe size of CreateEccParam
+		uint32_t ui32ThreadCount;	//coding threads, 0 for all cpu
+		uint32_t ui32IoDepth;		//requests kept in flight by the uring backend
+	};
+
+	inline uint32_t GetCpuCount() {
+		return std::max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	inline PROFILE GetDefaultProfile() {
+		PROFILE profile;
+		profile.ui32CpuCount = GetCpuCount();
+		profile.ui32IntertwineMB = DEFAULT_INTERTWINE_MB;
+		profile.ui32ThreadCount = 0;
+		profile.ui32IoDepth = FileIO::DEFAULT_IO_DEPTH;
+		return profile;
+	}
+
+	inline std::string GetProfilePath() {
+		const char* path = getenv("ECC_PROFILE");
+		if (path != nullptr && *path != 0) {
+			return path;
+		}
+		const char* home = getenv("HOME");
+		if (home == nullptr) {
+			home = getenv("USERPROFILE");
+		}
+		return std::string(home != nullptr ? home : ".") + "/.ecc_profile";
+	}
+
+	// "name=value" lines, unknown names are skipped, missing ones keep their default
+	inline bool LoadProfile(const std::string& file, PROFILE& profile) {
+		FILE* fp = fopen(file.c_str(), "r");
+		if (fp == nullptr) {
+			return false;
+		}
+		profile = GetDefaultProfile();
+		profile.ui32CpuCount = 0;
+		char line[256];
+		while (fgets(line, sizeof(line), fp) != nullptr) {
+			char name[64];
+			unsigned int value;
+			if (sscanf(line, " %63[a-z_] = %u", name, &value) != 2) {
+				continue;
+			}
+			std::string key = name;
+			if (key == "cpu_count") profile.ui32CpuCount = value;
+			else if (key == "intertwine_mb") profile.ui32IntertwineMB = value;
+			else if (key == "thread_count") profile.ui32ThreadCount = value;
+			else if (key == "io_depth") profile.ui32IoDepth = value;
+		}
+		fclose(fp);
+		return profile.ui32IntertwineMB>0 && profile.ui32IntertwineMB<4096 && profile.ui32IoDepth>0;
+	}
+
+	inline bool SaveProfile(const std::string& file, const PROFILE& profile) {
+		FILE* fp = fopen(file.c_str(), "w");
+		if (fp == nullptr) {
+			return false;
+		}
+		fprintf(fp, "cpu_count=%u\n", profile.ui32CpuCount);
+		fprintf(fp, "intertwine_mb=%u\n", profile.ui32IntertwineMB);
+		fprintf(fp, "thread_count=%u\n", profile.ui32ThreadCount);
+		fprintf(fp, "io_depth=%u\n", profile.ui32IoDepth);
+		return fclose(fp) == 0;
+	}
+
+	// read once per process, the defaults when there is no profile for this machine
+	inline const PROFILE& GetProfile() {
+		static const PROFILE profile = []() -> PROFILE {
+			PROFILE loaded;
+			if (LoadProfile(GetProfilePath(), loaded) && loaded.ui32CpuCount == GetCpuCount()) {
+				return loaded;
+			}
+			return GetDefaultProfile();
+		}();
+		return profile;
+	}
+
+	// the settings a coder runs with, 0 for the profile's
+	inline uint32_t GetThreadCount(uint32_t thread_count) {
+		if (thread_count == 0) {
+			thread_count = GetProfile().ui32ThreadCount;
+		}
+		uint32_t max_thread_count = GetCpuCount();
+		if (thread_count == 0 || thread_count>max_thread_count) {
+			thread_count = max_thread_count;
+		}
+		return thread_count;
+	}
+
+	inline uint32_t GetIoDepth(uint32_t io_depth) {
+		return io_depth != 0 ? io_depth : GetProfile().ui32IoDepth;
+	}
+
+	inline uint32_t GetIntertwineMB(uint32_t intertwine_mb) {
+		return intertwine_mb != 0 ? intertwine_mb : GetProfile().ui32IntertwineMB;
+	}
+};
+
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef _DEBUG
+#define NDEBUG
+#endif
+
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "../src/JobQueue.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+//several callers submit to one queue at once, each job must come out as from a coder of its own
+enum :uint32_t {
+	CALLER_COUNT = 4,
+	JOBS_PER_CALLER = 6,
+};
+
+std::atomic<uint32_t> failures(0);
+std::atomic<uint32_t> done_count(0);
+
+#define CHECK(x) do { if (!(x)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #x); failures++; } } while (0)
+
+void caller(CEccJobQueue* queue, uint32_t caller_index)
+{
+	uint32_t seed = caller_index + 1;
+	for (uint32_t k = 0; k<JOBS_PER_CALLER; k++) {
+		//sizes from a small object to a few stripes of 1MB
+		std::vector<uint8_t> data(4096 + (caller_index * 7 + k * 13) % 20 * 150000);
+		for (auto& x : data) {
+			seed = seed * 1103515245 + 12345;
+			x = (uint8_t)(seed >> 16);
+		}
+		CEccBufferCoder::ECC_PARAM param;
+		CHECK(CEccBufferCoder::CreateEccParam(param, 5, (k & 1) ? 8 : 16, 1, data.size()));
+
+		std::vector<uint8_t> expected((size_t)CEccBufferCoder::GetParityLength(param, data.size()));
+		CEccBufferCoder coder;
+		CHECK(coder.EncodeBuffer(data.data(), data.size(), expected.data(), expected.size(), param, nullptr, 1));
+
+		//two buffers, so the job also gathers a stripe across them
+		std::vector<CEccJobQueue::IO_VECTOR> vectors(2);
+		vectors[0].pBase = data.data();
+		vectors[0].uiLength = data.size() / 3;
+		vectors[1].pBase = data.data() + data.size() / 3;
+		vectors[1].uiLength = data.size() - data.size() / 3;
+
+		std::vector<uint8_t> parity(expected.size());
+		auto job = queue->SubmitEncode(vectors, parity.data(), parity.size(), param, nullptr, [](bool) { done_count++; });
+		CHECK(job != nullptr && job->Wait());
+		CHECK(parity == expected);
+
+		std::vector<uint8_t> original = data;
+		data[data.size() / 2] ^= 0x5a;
+		data[data.size() - 1] ^= 0xa5;
+		job = queue->SubmitCheck(vectors, parity.data(), parity.size(), param, nullptr, [](bool) { done_count++; });
+		CHECK(job != nullptr && job->Wait());
+		CHECK(data == original);
+	}
+}
+
+int main()
+{
+	{
+		CEccJobQueue queue(2, 3, 4);
+		std::vector<std::thread> callers;
+		for (uint32_t i = 0; i<CALLER_COUNT; i++) {
+			callers.push_back(std::thread(caller, &queue, i));
+		}
+		for (auto& t : callers) {
+			t.join();
+		}
+	}
+	CHECK(done_count == CALLER_COUNT*JOBS_PER_CALLER * 2);
+
+	if (failures != 0) {
+		printf("JobQueueTest: %u failed\n", (uint32_t)failures);
+		return 1;
+	}
+	printf("JobQueueTest: ok\n");
+	return 0;
+}
@@ -0,0 +1,124 @@
+#ifndef _DEBUG
+#define NDEBUG
+#endif
+
+#ifndef _CRT_SECURE_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "../src/FileCoder.hpp"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <fstream>
+
+//shards merged from files of their own and in place from one shared file must give the ecc file of -e,
+//and a merge of shards out of order or not done must fail and leave the target as it is
+enum :uint32_t {
+	SHARD_COUNT = 3,
+	RAW_LENGTH = 5 * 1024 * 1024 + 12345,	//several stripes of 1MB and a tail
+};
+
+uint32_t failures = 0;
+
+#define CHECK(x) do { if (!(x)) { printf("%s:%d: %s failed\n", __FILE__, __LINE__, #x); failures++; } } while (0)
+
+std::string dir = ".";
+std::vector<std::string> made;
+
+std::string name(const std::string& file)
+{
+	std::string path = dir + "/shard_test_" + file;
+	made.push_back(path);
+	return path;
+}
+
+std::string load(const std::string& file)
+{
+	std::ifstream in(file, std::ios::binary);
+	return std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+bool exists(const std::string& file)
+{
+	return std::ifstream(file).good();
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1) {
+		dir = argv[1];
+	}
+	std::string raw_file = name("raw");
+	{
+		std::vector<char> data(RAW_LENGTH);
+		uint32_t seed = 1;
+		for (auto& x : data) {
+			seed = seed * 1103515245 + 12345;
+			x = (char)(seed >> 16);
+		}
+		std::ofstream out(raw_file, std::ios::binary);
+		out.write(data.data(), data.size());
+	}
+
+	CEccFileCoder fc;
+	CEccFileCoder::ECC_PARAM param;
+	CHECK(CEccFileCoder::CreateEccParam(param, 5, 16, 1, RAW_LENGTH));
+
+	std::string full_file = name("full.ecc");
+	CHECK(fc.CreateEccFile(raw_file, full_file, param, nullptr, 2));
+	std::string full = load(full_file);
+	CHECK(full.size() == CEccFileCoder::GetEccFileLength(param, RAW_LENGTH));
+
+	//a file for every shard, done in any order
+	std::vector<std::string> shard_files;
+	for (uint32_t i = 0; i<SHARD_COUNT; i++) {
+		shard_files.push_back(name("part" + std::to_string(i) + ".ecc"));
+	}
+	for (uint32_t i = SHARD_COUNT; i-->0;) {
+		CHECK(fc.CreateEccShard(raw_file, shard_files[i], param, i, SHARD_COUNT, nullptr, 2));
+	}
+
+	//out of order or with a shard missing
+	std::string merged_file = name("merged.ecc");
+	std::vector<std::string> swapped = shard_files;
+	std::swap(swapped[0], swapped[1]);
+	CHECK(!fc.MergeEccShards(swapped, merged_file));
+	CHECK(!fc.MergeEccShards(std::vector<std::string>(shard_files.begin(), shard_files.end() - 1), merged_file));
+	CHECK(!exists(merged_file));
+	CHECK(!exists(merged_file + ".tmp"));
+
+	CHECK(fc.MergeEccShards(shard_files, merged_file));
+	CHECK(load(merged_file) == full);
+
+	//one shared file, merged in place once every shard is done
+	std::string shared_file = name("shared.ecc");
+	std::vector<std::string> shared(SHARD_COUNT, shared_file);
+	CHECK(fc.CreateEccShard(raw_file, shared_file, param, 1, SHARD_COUNT, nullptr, 2));
+	CHECK(fc.CreateEccShard(raw_file, shared_file, param, 0, SHARD_COUNT, nullptr, 2));
+	std::string incomplete = load(shared_file);
+	CHECK(!fc.MergeEccShards(shared, shared_file));
+	CHECK(load(shared_file) == incomplete);
+
+	CHECK(fc.CreateEccShard(raw_file, shared_file, param, 2, SHARD_COUNT, nullptr, 2));
+	CHECK(fc.MergeEccShards(shared, shared_file));
+	CHECK(load(shared_file) == full);
+	CHECK(!exists(shared_file + ".tmp"));
+
+	//the merged file has no shard records left, merging it again fails and keeps it
+	CHECK(!fc.MergeEccShards(shared, shared_file));
+	CHECK(load(shared_file) == full);
+
+	for (auto& file : made) {
+		remove(file.c_str());
+		remove((file + ".tmp").c_str());
+	}
+
+	if (failures != 0) {
+		printf("ShardTest: %u failed\n", failures);
+		return 1;
+	}
+	printf("ShardTest: ok\n");
+	return 0;
+}